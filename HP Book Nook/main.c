@@ -11,406 +11,3374 @@
  * - PA6: Latch pin -> 74HC595 RCLK (pin 12)
  * - PA7: Capacitive touch input (copper foil pad behind PLA)
  * - LED outputs via shift register (Q0-Q7 for 8 LED strips)
+ * - CHAIN_LENGTH daisy-chained 595s (QH' -> next SER) give 8-64 strips
  * - Per-strip enable/disable via enabled_strips bitmask
  * - Enabled LED strips turn on immediately when motion detected
  * - LED strips stay on while motion continues (timer resets continuously)
- * - LED strips turn off 5 seconds after motion stops
+ * - LED strips turn off 5 seconds after motion stops (per-strip delays
+ *   in milliseconds via strip_timeout_set(), up to TIMEOUT_CLASSES
+ *   distinct ones, timed from the sensor's release edge)
+ * - ISRs only post event flags; a main-loop dispatcher applies them
+ *   and commits the strip changes once per wake
+ * - Shift register updates are interrupt-driven; callers never wait on SPI
+ * - Touch scans are an interrupt-driven charge/convert state machine
+ * - Touch threshold tunes itself from a running noise estimate
+ * - Touch baseline persists in EEPROM and calibrates in the background,
+ *   so motion is live as soon as main() has set up the pins and SPI
+ * - Touch readings are compensated for temperature and VDD from the
+ *   internal sensors, with coefficients learned per unit
+ * - One tickless RTC scheduler holds every deadline (motion timeout, next
+ *   touch scan) and wakes the CPU only when the earliest one is due
+ * - Optional per-strip brightness via binary code modulation on TCA0
+ * - Motion timeout is an RTC compare deadline armed by PA2's rising edge,
+ *   so an idle unit gets no periodic wakeups from the motion side
+ * - Optional MOTION_CCL: PA2 latches a preloaded frame through CCL LUT0,
+ *   so the lights come on without waking the CPU
+ * - Idle touch scanning can park on the RTC with the ADC window comparator,
+ *   so the CPU stays in standby until the pad reading moves
+ * - Main loop sleeps in idle, standby or power-down, whichever is the
+ *   deepest mode the active subsystems allow; with touch sensing the
+ *   next scan is always on the RTC, so those builds bottom out at standby
+ * - Optional OE_PWM wiring: PA7 drives 595 OE for global dimming and fades
+ *   (replaces the touch pad)
  *
  * Default clock: 20 MHz internal oscillator with /6 prescaler = 3.333 MHz
  */
 
+#ifndef F_CPU
 #define F_CPU 3333333UL  /* 3.333 MHz (20 MHz / 6 prescaler) */
+#endif
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include <avr/power.h>
+#include <avr/eeprom.h>
+#include <stddef.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
 #include <util/delay.h>
 
-#define MOTION_PIN   PIN2_bm
+/* Output integrity check via QH' loopback (0 = off).
+ * Needs the OUTPUT_VERIFY wiring in WIRING.md: the last 595's QH' goes to
+ * PA2, the only SPI MISO pin on the 8-pin part, so the motion sensor moves
+ * to PA7 and capacitive touch is not available in this build.
+ */
+#ifndef OUTPUT_VERIFY
+#define OUTPUT_VERIFY 0
+#endif
+
+#if OUTPUT_VERIFY
+#define MOTION_PIN     PIN7_bm
+#define MOTION_PINCTRL PORTA.PIN7CTRL
+#else
+#define MOTION_PIN     PIN2_bm
+#define MOTION_PINCTRL PORTA.PIN2CTRL
+#endif
 #define LATCH_PIN    PIN6_bm
-#define TIMEOUT_SEC  5
-
-/* Shift register output bits (8 LED strips on QA-QH) */
-#define LED_STRIP_1  (1 << 0)
-#define LED_STRIP_2  (1 << 1)
-#define LED_STRIP_3  (1 << 2)
-#define LED_STRIP_4  (1 << 3)
-#define LED_STRIP_5  (1 << 4)
-#define LED_STRIP_6  (1 << 5)
-#define LED_STRIP_7  (1 << 6)
-#define LED_STRIP_8  (1 << 7)
-#define ALL_LEDS     0xFF
-
-/* Capacitive touch sensing */
+
+/* Default off-delay for every strip, in milliseconds */
+#ifndef TIMEOUT_MS
+#define TIMEOUT_MS   5000
+#endif
+
+/* Scheduler timebase: the RTC counts 32.768 kHz >> RTC_TICK_SHIFT (0-9).
+ * The default 5 gives 1024 Hz, ~1 ms resolution; every timeout and gap is
+ * rounded up to whole ticks, and a single off-delay spans 65535 ticks
+ * (64 s at 1024 Hz, 2 s at 32 kHz).
+ */
+#ifndef RTC_TICK_SHIFT
+#define RTC_TICK_SHIFT        5
+#endif
+
+#if RTC_TICK_SHIFT < 0 || RTC_TICK_SHIFT > 9
+#error "RTC_TICK_SHIFT must be 0-9"
+#endif
+
+#define RTC_TICKS_PER_SEC     (32768UL >> RTC_TICK_SHIFT)
+#define RTC_PRESCALER         (RTC_TICK_SHIFT << RTC_PRESCALER_gp)
+#define MS_TO_TICKS(ms)       ((uint16_t)(((uint32_t)(ms) * RTC_TICKS_PER_SEC + 999) / 1000))
+#define MAX_TIMEOUT_MS        (65535UL * 1000 / RTC_TICKS_PER_SEC)
+
+/* Scheduler limits: a 16-bit compare is only unambiguous half a wrap ahead,
+ * and a CMP write takes ~2 32 kHz clocks to reach the RTC */
+#define TIMER_MAX_WAIT        0x7FFF  /* Ticks; longer waits wake part-way */
+#define TIMER_MIN_LEAD        ((3 >> RTC_TICK_SHIFT) + 2)  /* CMP never closer */
+
+/* Per-strip off-delays: each strip uses one of TIMEOUT_CLASSES delays,
+ * held as a class number in TIMEOUT_CLASS_BITS bit-plane masks, so the
+ * cost per strip is a few bits however long the chain. Each class counts
+ * down on its own scheduler timer to the exact RTC tick, and classes that
+ * expire together are cleared in one commit. Strips of a class share its
+ * countdown: arming any of them restarts it for all of them still lit,
+ * and a strip moved to another class mid-countdown restarts in that one.
+ */
+#ifndef TIMEOUT_CLASS_BITS
+#define TIMEOUT_CLASS_BITS  2
+#endif
+
+#if TIMEOUT_CLASS_BITS < 0 || TIMEOUT_CLASS_BITS > 2
+#error "TIMEOUT_CLASS_BITS must be 0-2 (1-4 distinct off-delays)"
+#endif
+
+#define TIMEOUT_CLASSES     (1 << TIMEOUT_CLASS_BITS)
+
+#if TIMEOUT_MS < 1 || TIMEOUT_MS > MAX_TIMEOUT_MS
+#error "TIMEOUT_MS must fit 65535 RTC ticks"
+#endif
+
+/* Number of daisy-chained 74HC595s (1-8).
+ * Register 0 is wired to the MCU; its QH' feeds SER of register 1, etc.
+ */
+#ifndef CHAIN_LENGTH
+#define CHAIN_LENGTH 1
+#endif
+
+#if CHAIN_LENGTH < 1 || CHAIN_LENGTH > 8
+#error "CHAIN_LENGTH must be 1-8"
+#endif
+
+#define STRIP_COUNT  (CHAIN_LENGTH * 8)
+
+/* Strip bitmask wide enough for the whole chain.
+ * Bit n is strip n: register n/8, output Q(n%8).
+ * AVR is little-endian, so byte i of a mask is the frame for register i.
+ */
+#if CHAIN_LENGTH == 1
+typedef uint8_t strip_mask_t;
+#elif CHAIN_LENGTH == 2
+typedef uint16_t strip_mask_t;
+#elif CHAIN_LENGTH <= 4
+typedef uint32_t strip_mask_t;
+#else
+typedef uint64_t strip_mask_t;
+#endif
+
+#define STRIP_BIT(n) ((strip_mask_t)1 << (n))
+
+/* Per-strip 8-bit brightness via binary code modulation (0 = on/off only).
+ * TCA0 latches one bit-plane per slot; slot k lasts BCM_TICK << k CPU
+ * cycles. The shortest slot has to hold the ISR and the next plane's
+ * preload, so BCM_TICK grows with the chain (see below): a 255-tick frame
+ * is 255 * 64 / 3.333 MHz = 4.9 ms (204 Hz) for one 595 over SPI, 8.6 ms
+ * (117 Hz) for four. Each slot costs one ~60 cycle ISR for a single 595
+ * (+16 cycles per extra chained register): 8 x 60 x 204 Hz = ~98k
+ * cycles/s, about 3% CPU. BCM only runs while some lit strip is between
+ * 1 and 254. The bit-planes take 8 bytes per register, so past four
+ * registers they don't fit in SRAM.
+ */
+#ifndef STRIP_BRIGHTNESS
+#define STRIP_BRIGHTNESS 0
+#endif
+
+#if STRIP_BRIGHTNESS && CHAIN_LENGTH > 4
+#error "STRIP_BRIGHTNESS bit-planes for more than four registers don't fit in SRAM"
+#endif
+
+/* Global dimming and fades with TCA0 PWM on the 595 OE pin (0 = OE to GND).
+ * Needs the OE_PWM wiring in WIRING.md: OE moves to PA7 (TCA0 WO0 alternate
+ * pin), so capacitive touch is not available in this build. PWM runs at
+ * CLK_PER/64 / 255 = 204 Hz; fades step OE_FADE_STEP per PWM period.
+ */
+#ifndef OE_PWM
+#define OE_PWM 0
+#endif
+#define OE_PIN        PIN7_bm
+#define OE_FADE_STEP  2      /* 255 / 2 steps at 204 Hz = ~0.6 s fade */
+
+#if OE_PWM && STRIP_BRIGHTNESS
+#error "OE_PWM and STRIP_BRIGHTNESS both need TCA0"
+#endif
+
+/* Shift engine, selected per build.
+ * SHIFT_ENGINE_SPI:     SPI0 in buffer mode, interrupt-driven, CPU sleeps
+ *                       while the chain shifts. Clock set by SPI_CLOCK.
+ * SHIFT_ENGINE_BITBANG: unrolled VPORTA loop on the same pins, ~6 cycles
+ *                       per bit, CPU busy for the whole (short) transfer.
+ *
+ * Estimated cost per shift_out() for one 595, latch included
+ * (SHIFT_BENCHMARK=1 measures it on the target):
+ *   SPI CLK_PER/64   ~570 cycles  ~171 us  (512 of them asleep)
+ *   SPI CLK_PER/16   ~190 cycles   ~57 us
+ *   SPI CLK_PER/4     ~95 cycles   ~28 us
+ *   SPI CLK_PER/2     ~80 cycles   ~24 us  (ISR overhead dominates)
+ *   Bit-bang          ~60 cycles   ~18 us
+ */
+#define SHIFT_ENGINE_SPI      0
+#define SHIFT_ENGINE_BITBANG  1
+
+#ifndef SHIFT_ENGINE
+#define SHIFT_ENGINE SHIFT_ENGINE_SPI
+#endif
+
+/* Hardware SPI clock: SPI_PRESC_DIVn_gc, optionally | SPI_CLK2X_bm */
+#ifndef SPI_CLOCK
+#if STRIP_BRIGHTNESS
+#define SPI_CLOCK    (SPI_PRESC_DIV4_gc | SPI_CLK2X_bm)  /* CLK_PER/2 */
+#else
+#define SPI_CLOCK    SPI_PRESC_DIV64_gc                  /* CLK_PER/64 */
+#endif
+#endif
+
+/* BCM's least significant slot: ~48 cycles of TCA0 ISR and latch, plus
+ * the preload of every register, 16 cycles each over SPI at CLK_PER/2
+ * (BCM builds default to it) or ~50 bit-banged */
+#if SHIFT_ENGINE == SHIFT_ENGINE_BITBANG
+#define BCM_REG_CYCLES  50
+#else
+#define BCM_REG_CYCLES  16
+#endif
+#define BCM_TICK        (48 + BCM_REG_CYCLES * CHAIN_LENGTH)
+
+/* Measure shift_out() at boot into shift_bench_cycles/shift_bench_us */
+#ifndef SHIFT_BENCHMARK
+#define SHIFT_BENCHMARK 0
+#endif
+#if OUTPUT_VERIFY && SHIFT_ENGINE != SHIFT_ENGINE_SPI
+#error "OUTPUT_VERIFY reads QH' back through SPI0 MISO"
+#endif
+
+#if OUTPUT_VERIFY && OE_PWM
+#error "OUTPUT_VERIFY and OE_PWM both need PA7"
+#endif
+
+#define SHIFT_BENCH_RUNS  8       /* 8 x longest chain at CLK_PER/64 fits TCB0 */
+
+/* ISR profiler: min/max/sum execution time per ISR in CPU cycles, read
+ * with the debugger from stats.isr[] (see stats_t). Timestamps come from
+ * TCA0 running free at CLK_PER (16-bit, so ISRs up to 19.6 ms), which
+ * means TCA0 must not be claimed by STRIP_BRIGHTNESS or OE_PWM. Entry is
+ * stamped after the compiler's register save, so add ~20 cycles of
+ * prologue/epilogue.
+ * stats.isr[PROFILE_MOTION] is the motion-to-light benchmark: cycles from
+ * a PA2 edge to the commit that hands its frame to the shift engine, so
+ * it includes any ISR or dispatcher work queued ahead of it (run a touch
+ * build to see it under concurrent scans). SHIFT_BENCHMARK gives the
+ * fixed transfer time on top. The level 1 motion ISR can preempt the
+ * others, so their figures include any motion ISR that ran inside them.
+ */
+#ifndef ISR_PROFILE
+#define ISR_PROFILE 0
+#endif
+
+#if ISR_PROFILE && (STRIP_BRIGHTNESS || OE_PWM)
+#error "ISR_PROFILE needs TCA0 as a free-running timestamp counter"
+#endif
+
+/* Boot timing in CPU cycles from main() entry, read with the debugger:
+ * to motion live (PA2 interrupt and SPI running) and to the first pass
+ * of the main loop. TCB0 counts CLK_PER until touch scanning claims it.
+ * Reset to main() adds the start-up time fuse (FUSE.SYSCFG1 SUT, 64 ms
+ * as shipped; SUT_0MS with a stable supply) and ~20 us of oscillator
+ * and C runtime start-up.
+ */
+#ifndef BOOT_BENCHMARK
+#define BOOT_BENCHMARK 0
+#endif
+
+#if BOOT_BENCHMARK && SHIFT_BENCHMARK
+#error "BOOT_BENCHMARK and SHIFT_BENCHMARK both time with TCB0"
+#endif
+
+/* Sleep residency counters per sleep depth (entries and RTC ticks) */
+#ifndef SLEEP_STATS
+#define SLEEP_STATS 0
+#endif
+
+/* Hardware motion-to-light: CCL LUT0 drives the 595 RCLK on PA6 as
+ * NOT(PA2) XOR event, so PA2's falling edge latches the chain with no CPU
+ * involved (one gate delay, works in power-down). After every latched
+ * frame the SPI engine preloads frame | motion_enabled_strips into the
+ * shift stage without latching, which is what the edge then shows.
+ * Software latches are an EVSYS strobe on the LUT's event input, which
+ * gives RCLK a rising edge whatever level PA2 is at. PA2 only interrupts
+ * on its rising edge, to start the timeouts and resync the frame.
+ */
+#ifndef MOTION_CCL
+#define MOTION_CCL 0
+#endif
+
+#if MOTION_CCL && (OUTPUT_VERIFY || STRIP_BRIGHTNESS || OE_PWM || SHIFT_ENGINE != SHIFT_ENGINE_SPI)
+#error "MOTION_CCL needs the SPI engine, motion on PA2 and a frame the latch alone makes visible"
+#endif
+
+#define CCL_TRUTH_RCLK     0xA5    /* IN2 (PA2) low XOR IN0 (strobe); IN1 masked */
+
+/* Shift register output bits (first 8 LED strips on QA-QH of register 0) */
+#define LED_STRIP_1  STRIP_BIT(0)
+#define LED_STRIP_2  STRIP_BIT(1)
+#define LED_STRIP_3  STRIP_BIT(2)
+#define LED_STRIP_4  STRIP_BIT(3)
+#define LED_STRIP_5  STRIP_BIT(4)
+#define LED_STRIP_6  STRIP_BIT(5)
+#define LED_STRIP_7  STRIP_BIT(6)
+#define LED_STRIP_8  STRIP_BIT(7)
+#define ALL_LEDS     ((strip_mask_t)~(strip_mask_t)0 >> (sizeof(strip_mask_t) * 8 - STRIP_COUNT))
+
+/* Capacitive touch sensing (PA7 is taken in OE_PWM and OUTPUT_VERIFY builds) */
+#define TOUCH_SENSING      (!OE_PWM && !OUTPUT_VERIFY)
 #define TOUCH_PIN          PIN7_bm
 #define TOUCH_ADC_CH       ADC_MUXPOS_AIN7_gc
-#define TOUCH_SAMPLES      64      /* Samples per scan (power of 2) */
-#define TOUCH_THRESHOLD    20      /* ADC counts above baseline = touch */
+/* Capacitive voltage divider mode (0 = single-ended charge-then-float).
+ * Alternates pad-HIGH/S&H-at-GND and pad-LOW/S&H-at-VREF charges, so
+ * common-mode noise cancels and half the conversions are needed.
+ */
+#ifndef TOUCH_CVD
+#define TOUCH_CVD 0
+#endif
+
+#if TOUCH_CVD
+#define TOUCH_SAMPLES      32      /* Conversions per scan (power of 2) */
+#define TOUCH_SAMPLE_SHIFT 5       /* log2(TOUCH_SAMPLES) */
+#else
+#define TOUCH_SAMPLES      64      /* Conversions per scan (power of 2) */
+#define TOUCH_SAMPLE_SHIFT 6       /* log2(TOUCH_SAMPLES) */
+#endif
+
+/* Conversions accumulated per pad charge (ADC0 SAMPNUM, 1-64). More
+ * per charge means fewer charges per scan: less time charging, but each
+ * result sees the pad further into its decay. */
+#ifndef TOUCH_ADC_ACC
+#define TOUCH_ADC_ACC      4
+#endif
+
+#if TOUCH_ADC_ACC == 1
+#define TOUCH_ADC_SAMPNUM  ADC_SAMPNUM_ACC1_gc
+#elif TOUCH_ADC_ACC == 2
+#define TOUCH_ADC_SAMPNUM  ADC_SAMPNUM_ACC2_gc
+#elif TOUCH_ADC_ACC == 4
+#define TOUCH_ADC_SAMPNUM  ADC_SAMPNUM_ACC4_gc
+#elif TOUCH_ADC_ACC == 8
+#define TOUCH_ADC_SAMPNUM  ADC_SAMPNUM_ACC8_gc
+#elif TOUCH_ADC_ACC == 16
+#define TOUCH_ADC_SAMPNUM  ADC_SAMPNUM_ACC16_gc
+#elif TOUCH_ADC_ACC == 32
+#define TOUCH_ADC_SAMPNUM  ADC_SAMPNUM_ACC32_gc
+#elif TOUCH_ADC_ACC == 64
+#define TOUCH_ADC_SAMPNUM  ADC_SAMPNUM_ACC64_gc
+#else
+#error "TOUCH_ADC_ACC must be 1, 2, 4, 8, 16, 32 or 64"
+#endif
+
+#if TOUCH_ADC_ACC > TOUCH_SAMPLES
+#error "TOUCH_ADC_ACC can't exceed TOUCH_SAMPLES"
+#endif
+
+#if TOUCH_CVD && TOUCH_ADC_ACC * 2 > TOUCH_SAMPLES
+#error "TOUCH_CVD needs at least one charge of each polarity per scan"
+#endif
+
+#define TOUCH_CHARGES      (TOUCH_SAMPLES / TOUCH_ADC_ACC)
+#define TOUCH_CVD_FULL     (1023 * TOUCH_ADC_ACC)  /* Full-scale accumulated RES */
+#define TOUCH_CHARGE_TOP   83      /* CLK_PER/2 / 83 = 50 us pad charge */
+#define TOUCH_ADC_CTRLC    ((0x01 << 4) | (0x03 << 0))  /* VDD ref, /16; see adc_init() */
+#define TOUCH_THRESHOLD    20      /* Starting threshold, in ADC counts */
 #define TOUCH_DEBOUNCE     5       /* Consecutive readings to confirm */
 #define BASELINE_SHIFT     7       /* Baseline adaptation speed (slower) */
-#define BASELINE_INIT_CYCLES 16    /* Startup calibration samples */
-#define TCB_SCAN_TOP       41666   /* CLK_PER/2 / 41666 ≈ 40 Hz */
+#define BASELINE_INIT_CYCLES 16    /* Scans averaged by background calibration */
+#define TOUCH_SAVE_DELTA   (TOUCH_THRESHOLD / 2)  /* Drift that rewrites EEPROM */
+
+/* Self-tuning threshold: untouched readings feed a running mean absolute
+ * deviation from the baseline (8.8 fixed point). A touch must rise
+ * TOUCH_SNR times that above the baseline, clamped to the MIN/MAX range,
+ * and is released below half of it. A touch held for TOUCH_MAX_HOLD_SEC
+ * is taken as stuck (a drop of water, an object on the pad): it is
+ * released and the baseline restarts from the current reading. A reading
+ * a whole threshold below the baseline is no touch and no noise: the
+ * baseline is stale (a stuck touch's, once the pad is clear), so it
+ * closes in at BASELINE_SHIFT_STALE and the noise estimate skips it.
+ */
+#define TOUCH_SNR          6       /* ~5 sigma; MAD is ~0.8 sigma */
+#define TOUCH_THRESHOLD_MIN 4
+#define TOUCH_THRESHOLD_MAX 80
+#define TOUCH_NOISE_SHIFT  5       /* Noise estimate averages ~32 scans */
+#define TOUCH_NOISE_INIT   ((TOUCH_THRESHOLD << 8) / TOUCH_SNR)
+#define TOUCH_MAX_HOLD_SEC 30
+#define BASELINE_SHIFT_STALE 2     /* A quarter of the gap per scan */
+#define TOUCH_MAX_HOLD_TICKS ((uint32_t)TOUCH_MAX_HOLD_SEC * RTC_TICKS_PER_SEC)
+#define TOUCH_GAP_TICKS    MS_TO_TICKS(20)  /* 20 ms gap + ~5 ms scan ≈ 40 Hz */
+                                   /* (~2.7 ms acquisition with TOUCH_CVD) */
+
+/* Scan-rate governor: idle scans follow a 200 ms gap (~5 Hz); a reading
+ * half the touch threshold above baseline bursts to the ~40 Hz rate until
+ * TOUCH_BURST_HOLD scans after release. The slow baseline shift keeps the
+ * IIR time constant (~3 s) the same at both rates.
+ */
+#define TOUCH_SLOW_GAP_TICKS MS_TO_TICKS(200)
+#define TOUCH_BURST_HOLD   8       /* Fast scans kept after activity */
+#define BASELINE_SHIFT_SLOW (BASELINE_SHIFT - 3)  /* 8x fewer scans */
+
+/* Standby touch parking (0 = idle scans stay full scans at the slow rate).
+ * Once the governor goes idle, the scheduler takes one TOUCH_ADC_ACC charge
+ * every 250 ms. ADC0 converts in standby (RUNSTBY) and only its window
+ * comparator reports back, when the result leaves half the touch threshold
+ * above / the threshold below the baseline; that resumes fast scanning.
+ * The CPU still wakes for each 50 us pad charge, since the pad has to be
+ * driven and then floated. Not with TOUCH_CVD: a parked charge has one
+ * polarity, and the baseline the window sits on is the mean of both.
+ * Parked is standby, not power-down: the 250 ms deadline is a scheduler
+ * timer on the RTC counter, which stops in power-down. Moving it to the
+ * PIT, which doesn't, would also need the other deadlines' time kept
+ * across the gap.
+ */
+#ifndef TOUCH_STANDBY
+#define TOUCH_STANDBY (TOUCH_SENSING && !TOUCH_CVD)
+#endif
+
+#if TOUCH_STANDBY && !TOUCH_SENSING
+#error "TOUCH_STANDBY needs the touch pad on PA7"
+#endif
+
+#if TOUCH_STANDBY && TOUCH_CVD
+#error "TOUCH_STANDBY parks on single-ended charges; TOUCH_CVD has no baseline for them"
+#endif
+
+#define TOUCH_PARK_TICKS   MS_TO_TICKS(250)  /* Parked scans at 4 Hz */
+
+/* Temperature/VDD compensation (0 = raw readings). Every TOUCH_COMP_SCANS
+ * full scans, and whenever a reading jumps half the threshold, ADC0
+ * measures the internal temperature sensor (factory calibration from
+ * SIGROW) and VDD (the 1.1 V reference against VDD) between scans, driven
+ * from the TCB0 and ADC0 ISRs like a pad charge. Readings are
+ * corrected by kt * dT + kv * dV from the first sample's conditions
+ * before any threshold comparison, so a supply step or a warming room
+ * doesn't walk the pad through the threshold faster than the baseline
+ * can follow. The coefficients start at the _INIT values and are learned
+ * per unit from what got through: the reading after one that jumped half
+ * the threshold just as a sensor moved by TOUCH_COMP_MOVE (taken whole
+ * under the new correction, unlike the jump itself, which may straddle
+ * the move), or two untouched windows with steady sensors whose raw sums
+ * differ by more than the noise estimate and correction. Small moves step
+ * a coefficient by TOUCH_COMP_STEP; past TOUCH_COMP_SPAN the error is
+ * fitted. One still past the threshold may be a finger, so it only
+ * teaches, fitted, once it lets go with the sensor moving back.
+ * Off by default past four registers, or two with STRIP_BRIGHTNESS: its
+ * ~40 bytes of state don't fit beside longer chains' strip masks and
+ * bit-planes (STACK_RESERVE).
+ */
+#ifndef TOUCH_COMPENSATE
+#define TOUCH_COMPENSATE (TOUCH_SENSING && CHAIN_LENGTH <= (STRIP_BRIGHTNESS ? 2 : 4))
+#endif
+
+#if TOUCH_COMPENSATE && !TOUCH_SENSING
+#error "TOUCH_COMPENSATE needs the touch pad on PA7"
+#endif
+
+#define TOUCH_COMP_SCANS   16      /* Full scans between sensor samples */
+#define TOUCH_COMP_STEP    16      /* Coefficient step, 1/16 count (8.8) */
+#define TOUCH_COMP_MOVE    2       /* Sensor move that can teach: 2 K, 20 mV */
+#define TOUCH_COMP_SPAN    16      /* One whose jump is fitted: 16 K, 160 mV */
+#define TOUCH_COMP_K_MAX   (8 << 8)  /* Coefficient clamp, counts (8.8) */
+#define TOUCH_COMP_RELEASE ((int16_t)0x8000)  /* touch_comp_offset: a held rise let go */
+#define TOUCH_SAVE_K_DELTA (4 * TOUCH_COMP_STEP)  /* Coefficient move that rewrites EEPROM */
+#define TOUCH_COMP_TEMP_MIN 233    /* Restorable references: -40..125 C, */
+#define TOUCH_COMP_TEMP_MAX 398
+#define TOUCH_COMP_VDD_MIN 180     /* 1.8..5.5 V */
+#define TOUCH_COMP_VDD_MAX 550
+#ifndef TOUCH_COMP_KT_INIT
+#define TOUCH_COMP_KT_INIT 0       /* Counts per kelvin (8.8) */
+#endif
+#ifndef TOUCH_COMP_KV_INIT
+#define TOUCH_COMP_KV_INIT 0       /* Counts per 10 mV of VDD (8.8) */
+#endif
+#define TOUCH_SENSOR_SAMPLEN 7     /* +7 ADC clocks: >= 32 us for TEMPSENSE */
+#define TOUCH_SENSOR_SETTLE_TOP 42 /* CLK_PER/2 / 42 = 25 us reference start-up */
+
+/* Motion sensor state: 1 between a falling and a rising PA2 edge */
+volatile uint8_t motion_active = 0;
+
+/* Events the ISRs hand to the main-loop dispatcher: one pending bit per
+ * kind, and a latest-value slot for the ones that carry data. A repeat
+ * before the dispatcher runs merges into the pending bit, so no event can
+ * be lost to a full buffer and stop scanning, keep strips lit or hold a
+ * fade. ISR_PROFILE counts those merges per kind (stats.coalesced).
+ */
+enum
+{
+    EVENT_MOTION     = 0x01, /* PA2 edge; motion_level is the line now */
+    EVENT_TIMER      = 0x02, /* RTC compare: a scheduler deadline may be due */
+#if TOUCH_SENSING
+    EVENT_TOUCH_SCAN = 0x04, /* Scan finished; touch_reading is the result */
+#endif
+#if TOUCH_STANDBY
+    EVENT_TOUCH_WAKE = 0x08, /* Parked scan left the baseline window */
+#endif
+#if OE_PWM
+    EVENT_FADE_DONE  = 0x10, /* Fade-out reached 0; switch fade_off_strips off */
+#endif
+#if TOUCH_COMPENSATE
+    EVENT_TOUCH_SENSORS = 0x20, /* Sensor sample done; touch_*_raw hold it */
+#endif
+};
+
+#define EVENT_KINDS      6       /* Bits the EVENT_* values use */
+
+volatile uint8_t event_pending = 0;      /* EVENT_* bits not yet dispatched */
+volatile uint8_t motion_level = 0;       /* 1 = PA2 low at the last edge */
+#if TOUCH_SENSING
+volatile uint16_t touch_reading = 0;     /* Filtered reading of the last scan */
+#endif
+#if TOUCH_COMPENSATE
+volatile uint16_t touch_vdd_raw = 0;     /* 1.1 V against VDD, accumulated */
+volatile uint16_t touch_temp_raw = 0;    /* Temperature sensor, accumulated */
+#endif
+
+/* Tickless scheduler: every deadline shares the RTC compare channel */
+enum
+{
+    TIMER_OFF,          /* Strip off-delays, one per class from here */
+    TIMER_OFF_LAST = TIMER_OFF + TIMEOUT_CLASSES - 1,
+#if TOUCH_SENSING
+    TIMER_TOUCH,        /* Next touch scan */
+#endif
+    TIMER_COUNT
+};
+
+uint32_t timer_deadline[TIMER_COUNT];  /* Expiry on the extended RTC clock */
+uint8_t timer_armed = 0;               /* Bit n: timer n is pending */
+uint32_t timer_clock = 0;              /* RTC.CNT extended to 32 bits */
+uint16_t timer_last_cnt = 0;           /* RTC.CNT at the last timer_now() */
+uint32_t timer_target = 0;             /* Deadline RTC.CMP is set for */
+
+/* Strip off-delays */
+uint16_t timeout_ticks[TIMEOUT_CLASSES];        /* Off-delay per class, RTC ticks */
+#if TIMEOUT_CLASS_BITS
+strip_mask_t timeout_class[TIMEOUT_CLASS_BITS]; /* Bit b of each strip's class */
+#endif
+strip_mask_t timeout_pending = 0;               /* Strips counting down */
+
+/* Link-time RAM check. The linker places .noinit after .data and .bss,
+ * right below the stack, so this reserve makes it reject ("region data
+ * overflowed") any configuration whose globals leave the stack less than
+ * STACK_RESERVE of the 256 bytes. Nothing uses it; the stack grows into it.
+ */
+#ifndef STACK_RESERVE
+#define STACK_RESERVE 64
+#endif
 
-/* Global timer countdown in seconds (0 = LED off) */
-volatile uint8_t led_timer = 0;
+uint8_t stack_reserve[STACK_RESERVE] __attribute__((section(".noinit"), used));
 
-/* Current shift register state */
-volatile uint8_t shift_reg_state = 0;
+/* Current shift register state (whole chain).
+ * This is the shadow the strip API edits; output_commit() pushes it to the
+ * 595s once per wake, and only if it differs from output_frame.
+ */
+volatile strip_mask_t shift_reg_state = 0;
+
+/* Write-combining output layer */
+#define OUTPUT_DIRTY  0x01   /* shift_reg_state may have changed */
+#define OUTPUT_FORCE  0x02   /* Push even if unchanged (brightness, boot) */
+volatile uint8_t output_dirty = 0;
+strip_mask_t output_frame = 0;           /* Last state handed to the 595s */
+volatile uint16_t spi_frames = 0;        /* Frames shifted and latched */
+volatile uint16_t spi_avoided = 0;       /* Updates that needed no transfer */
+
+/* The motion ISR runs at CPUINT level 1 and may commit in the middle of
+ * main-loop code, so read-modify-writes of the strip state from there run
+ * in ATOMIC_BLOCK(ATOMIC_RESTORESTATE), which leaves interrupts as it
+ * found them and so also works with them already disabled.
+ */
 
 /* Per-strip enable/disable mask.
  * Each bit controls whether that strip participates in motion detection.
  * Strips can still be controlled manually regardless of this mask.
  */
-uint8_t motion_enabled_strips = ALL_LEDS;  /* All respond to motion by default */
+strip_mask_t motion_enabled_strips = ALL_LEDS;  /* All respond to motion by default */
 
 /* Capacitive touch state */
 volatile uint16_t touch_baseline = 0;
+uint8_t touch_baseline_frac = 0;   /* Sub-count part of the baseline, /256 */
 volatile uint8_t touch_debounce_cnt = 0;
 volatile uint8_t touch_state = 0;  /* 0 = released, 1 = touched */
+uint16_t touch_noise = TOUCH_NOISE_INIT;   /* Untouched MAD, x256 */
+uint8_t touch_threshold = TOUCH_THRESHOLD; /* Current touch level, counts */
+uint32_t touch_since = 0;          /* timer_now() when the touch began */
+uint16_t touch_stuck = 0;          /* Stuck touches released, for the debugger */
+uint16_t touch_events = 0;         /* Confirmed touches, for drift testing */
+
+#if TOUCH_COMPENSATE
+/* Temperature/VDD compensation state */
+int16_t touch_comp_kt = TOUCH_COMP_KT_INIT;  /* Counts per kelvin (8.8) */
+int16_t touch_comp_kv = TOUCH_COMP_KV_INIT;  /* Counts per 10 mV (8.8) */
+uint16_t touch_temp_ref = 0;       /* Kelvin at the first sample, 0 = none */
+uint16_t touch_vdd_ref = 0;        /* VDD at the first sample, 10 mV */
+int16_t touch_temp_delta = 0;      /* Latest sample minus the reference */
+int16_t touch_vdd_delta = 0;
+int16_t touch_comp = 0;            /* Correction taken off readings, counts */
+int16_t touch_comp_offset = 0;     /* Jump the pending sample is for, 0 = none */
+uint8_t touch_comp_jump = 0;       /* Readings a threshold off the baseline:
+                                      0 none, 1 the first (the baseline
+                                      holds), 2 more */
+int8_t touch_comp_rise_temp = 0;   /* How far the sensors went for a held rise */
+int8_t touch_comp_rise_vdd = 0;
+int16_t touch_comp_rise_err = 0;   /* What the correction left of it */
+int8_t touch_comp_check_temp = 0;  /* A jump's sensor move, for the next reading */
+int8_t touch_comp_check_vdd = 0;
+uint8_t touch_comp_left = 0;       /* Full scans until the next sample */
+uint8_t touch_comp_clean = 0;      /* Untouched scans in this window */
+uint16_t touch_comp_sum = 0;       /* Their raw readings, summed */
+uint16_t touch_comp_prev = 0;      /* Sum of the last steady window, 0 = none */
+int16_t touch_comp_prev_temp = 0;  /* Its sensor deltas */
+int16_t touch_comp_prev_vdd = 0;
+#endif
+
+/* Touch acquisition state machine */
+#define TOUCH_GAP          0       /* Waiting for the next scan */
+#define TOUCH_CHARGING     1       /* Pad driven high, TCB0 timing 50 us */
+#define TOUCH_CONVERTING   2       /* Pad floating, ADC accumulating */
+#define TOUCH_SENSOR_SETTLE 3      /* 1.1 V reference starting, TCB0 timing it */
+#define TOUCH_SENSOR_VDD   4       /* ADC accumulating 1.1 V against VDD */
+#define TOUCH_SENSOR_TEMP  5       /* ADC accumulating the temperature sensor */
+volatile uint8_t touch_phase = TOUCH_GAP;
+volatile uint8_t touch_charges_left = 0;
+volatile uint16_t touch_sum = 0;
+volatile uint8_t touch_burst_left = TOUCH_BURST_HOLD;  /* Fast scans to go */
+volatile uint8_t touch_parked = 0;  /* Scanning from the RTC, CPU in standby */
+
+#if TOUCH_SENSING
+/* Background calibration and the baseline persisted in EEPROM. A record
+ * is valid when its layout byte and CRC match, so an erased EEPROM (a
+ * fresh flash without EESAVE), a save cut short by power loss or a
+ * record in another build's layout calibrates from scratch. With
+ * TOUCH_COMPENSATE the baseline is a corrected one, so the record
+ * carries the learned coefficients and the sensor references it was
+ * corrected against.
+ */
+typedef struct
+{
+    uint16_t baseline;
+#if TOUCH_COMPENSATE
+    int16_t kt;
+    int16_t kv;
+    uint16_t temp_ref;
+    uint16_t vdd_ref;
+#endif
+    uint8_t layout;              /* TOUCH_RECORD_LAYOUT */
+    uint8_t check;               /* CRC-8 of the bytes before it */
+} touch_record_t;
+
+#define TOUCH_RECORD_SIZE      (offsetof(touch_record_t, check) + 1)
+
+/* Format 1 in the high nibble, the record size in the low one */
+#define TOUCH_RECORD_LAYOUT    (0x10 | TOUCH_RECORD_SIZE)
+
+touch_record_t touch_record EEMEM;
+uint8_t touch_calib_left = 0;      /* Scans left in the averaging window */
+uint8_t touch_calib_blind = 0;     /* No usable baseline: touches ignored */
+uint16_t touch_calib_sum = 0;
+uint16_t touch_saved = 0xFFFF;     /* Baseline the EEPROM record holds */
+#if TOUCH_COMPENSATE
+int16_t touch_saved_kt = TOUCH_COMP_KT_INIT;  /* Coefficients it holds */
+int16_t touch_saved_kv = TOUCH_COMP_KV_INIT;
+#endif
+uint8_t touch_save_left = 0;       /* Record bytes still to write */
+#endif
+
+#if STRIP_BRIGHTNESS
+/* Brightness bit-planes: bit n of bcm_bits[k] is bit k of strip n's level */
+strip_mask_t bcm_bits[8] = {
+    ALL_LEDS, ALL_LEDS, ALL_LEDS, ALL_LEDS,
+    ALL_LEDS, ALL_LEDS, ALL_LEDS, ALL_LEDS
+};
+volatile uint8_t bcm_running = 0;
+volatile uint8_t bcm_plane = 0;  /* Plane preloaded in the shift register */
+#endif
+
+#if OE_PWM
+/* OE PWM state: duty 0-255 */
+uint8_t oe_brightness = 255;            /* Global brightness when lit */
+volatile uint8_t oe_level = 0;          /* Duty currently in CMP0 */
+volatile uint8_t fade_target = 0;       /* Duty the ramp is heading to */
+volatile strip_mask_t fade_off_strips = 0; /* Strips to clear when faded out */
+#endif
+
+/* Asynchronous shift engine state */
+volatile uint8_t spi_busy = 0;              /* Transfer in flight */
+volatile uint8_t spi_pending = 0;           /* A newer frame is waiting */
+volatile strip_mask_t spi_pending_frame = 0; /* Frame to shift after current one */
+#if MOTION_CCL
+volatile uint8_t spi_preloading = 0;        /* Transfer is the unlatched motion frame */
+#endif
+strip_mask_t spi_frame;                     /* Snapshot being shifted out */
+volatile uint8_t spi_index = 0;             /* Registers left to write */
+
+#if OUTPUT_VERIFY
+/* SPI clocks tried by spi_autotune(), fastest first */
+static const uint8_t spi_clocks[] = {
+    SPI_PRESC_DIV4_gc | SPI_CLK2X_bm,    /* CLK_PER/2 */
+    SPI_PRESC_DIV4_gc,                   /* CLK_PER/4 */
+    SPI_PRESC_DIV16_gc | SPI_CLK2X_bm,   /* CLK_PER/8 */
+    SPI_PRESC_DIV16_gc,                  /* CLK_PER/16 */
+    SPI_PRESC_DIV64_gc | SPI_CLK2X_bm,   /* CLK_PER/32 */
+    SPI_PRESC_DIV64_gc,                  /* CLK_PER/64 */
+    SPI_PRESC_DIV128_gc                  /* CLK_PER/128 */
+};
+#define SPI_CLOCK_COUNT  (sizeof(spi_clocks) / sizeof(spi_clocks[0]))
+
+volatile uint8_t spi_clock_index = SPI_CLOCK_COUNT - 1;  /* Into spi_clocks[] */
+volatile uint16_t spi_errors = 0;   /* Frames that came back corrupted */
+strip_mask_t spi_prev_frame;        /* What the chain held before this transfer */
+volatile uint8_t spi_prev_valid = 0; /* spi_prev_frame is known good to compare */
+volatile uint8_t spi_rx_index = 0;  /* Next byte of spi_prev_frame expected */
+volatile uint8_t spi_rx_error = 0;  /* Mismatch seen in this transfer */
+#define SPI_CLOCK_NOW    spi_clocks[spi_clock_index]
+#else
+#define SPI_CLOCK_NOW    SPI_CLOCK
+#endif
+
+#if ISR_PROFILE
+/* Per-ISR execution time statistics, in CPU cycles */
+typedef struct
+{
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+    uint16_t count;
+} isr_stat_t;
+
+enum
+{
+    PROFILE_PORTA,
+    PROFILE_RTC,
+    PROFILE_TCB0,
+    PROFILE_ADC,
+    PROFILE_SPI,
+    PROFILE_MOTION,     /* Not an ISR: PA2 edge to the frame's commit */
+    PROFILE_COUNT
+};
+
+volatile uint16_t motion_stamp = 0;  /* TCA0.CNT at the last motion edge */
+volatile uint8_t motion_timing = 0;  /* Next commit closes a measurement */
+
+#define PROFILE_ENTER()    uint16_t profile_start = TCA0.SINGLE.CNT
+#define PROFILE_EXIT(id)   profile_record(id, profile_start)
+#else
+#define PROFILE_ENTER()
+#define PROFILE_EXIT(id)
+#endif
+
+/* Sleep depths chosen by sleep_depth(), shallowest first */
+enum
+{
+    SLEEP_DEPTH_IDLE,
+    SLEEP_DEPTH_STANDBY,
+    SLEEP_DEPTH_PWR_DOWN,
+    SLEEP_DEPTHS
+};
+
+static const uint8_t sleep_modes[SLEEP_DEPTHS] = {
+    SLEEP_MODE_IDLE, SLEEP_MODE_STANDBY, SLEEP_MODE_PWR_DOWN
+};
+
+#if ISR_PROFILE || SLEEP_STATS
+/*
+ * Profiler and sleep counters in one fixed layout, so a tool can dump
+ * sizeof(stats_t) bytes from &stats (debugger, UPDI or the host
+ * simulation) and decode them without the ELF. Little-endian, no padding
+ * on AVR. The header says which sections follow, in this order:
+ *   STATS_ISR     isr[PROFILE_COUNT]: min, max (uint16), sum (uint32),
+ *                 count (uint16), in PROFILE_* order, then
+ *                 coalesced[EVENT_KINDS] (uint8, sticks at 255): events
+ *                 posted while already pending, by EVENT_* bit
+ *   STATS_SLEEP   sleep_entries[SLEEP_DEPTHS] (uint16), then
+ *                 sleep_ticks[SLEEP_DEPTHS] (uint32), idle first
+ * Sleep ticks are RTC counts (RTC_TICKS_PER_SEC); the counter stops in
+ * power-down, so that row only counts entries and its time is what is
+ * left of the wall clock. Bump STATS_VERSION on any layout change.
+ */
+#define STATS_MAGIC     0x5354  /* "TS" in memory order */
+#define STATS_VERSION   2
+#define STATS_ISR       0x01
+#define STATS_SLEEP     0x02
+
+typedef struct
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t size;               /* sizeof(stats_t) */
+    uint8_t sections;           /* STATS_ISR | STATS_SLEEP */
+    uint8_t tick_shift;         /* RTC_TICK_SHIFT */
+#if ISR_PROFILE
+    isr_stat_t isr[PROFILE_COUNT];
+    uint8_t coalesced[EVENT_KINDS];
+#endif
+#if SLEEP_STATS
+    uint16_t sleep_entries[SLEEP_DEPTHS];
+    uint32_t sleep_ticks[SLEEP_DEPTHS];
+#endif
+} stats_t;
+
+stats_t stats = {
+    .magic = STATS_MAGIC,
+    .version = STATS_VERSION,
+    .size = sizeof(stats_t),
+    .sections = (ISR_PROFILE ? STATS_ISR : 0) | (SLEEP_STATS ? STATS_SLEEP : 0),
+    .tick_shift = RTC_TICK_SHIFT,
+};
+#endif
+
+#if BOOT_BENCHMARK
+volatile uint16_t boot_motion_cycles = 0;  /* main() entry to sei() */
+volatile uint16_t boot_loop_cycles = 0;    /* main() entry to the main loop */
+#endif
+
+#if SHIFT_BENCHMARK
+/* Average cost of one shift_out(), read with the debugger */
+volatile uint16_t shift_bench_cycles = 0;
+volatile uint16_t shift_bench_us = 0;
+#endif
+
+
+#if ISR_PROFILE
+/*
+ * Start TCA0 free-running at CLK_PER as the profiler timestamp counter.
+ */
+static void profile_init(void)
+{
+    for (uint8_t i = 0; i < PROFILE_COUNT; i++)
+    {
+        stats.isr[i].min = 0xFFFF;
+    }
+
+    TCA0.SINGLE.PER = 0xFFFF;
+    TCA0.SINGLE.CTRLA = TCA_SINGLE_CLKSEL_DIV1_gc | TCA_SINGLE_ENABLE_bm;
+}
+
+/*
+ * Fold one ISR run into its statistics. Unsigned subtraction handles a
+ * counter wrap between entry and exit.
+ */
+static inline void profile_record(uint8_t id, uint16_t start)
+{
+    uint16_t elapsed = TCA0.SINGLE.CNT - start;
+    isr_stat_t *stat = &stats.isr[id];
+
+    if (elapsed < stat->min)
+    {
+        stat->min = elapsed;
+    }
+
+    if (elapsed > stat->max)
+    {
+        stat->max = elapsed;
+    }
+
+    stat->sum += elapsed;
+    stat->count++;
+}
+#endif
+
+/*
+ * Mark events pending for the main loop. ISR context only. The level 1
+ * motion ISR can preempt the others, so the read-modify-write holds
+ * interrupts off to keep its bits.
+ */
+static void event_post(uint8_t events)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+#if ISR_PROFILE
+        uint8_t again = event_pending & events;
+
+        for (uint8_t i = 0; again; i++, again >>= 1)
+        {
+            if ((again & 1) && stats.coalesced[i] != 0xFF)
+            {
+                stats.coalesced[i]++;
+            }
+        }
+#endif
+        event_pending |= events;
+    }
+}
+
+#if SHIFT_ENGINE == SHIFT_ENGINE_SPI
+/*
+ * Initialize SPI in master mode for 74HC595 communication.
+ * - PA1 (MOSI): Serial data out
+ * - PA3 (SCK): Clock
+ * - CLK_PER/64 = ~52 kHz (slower for reliability), or CLK_PER/2 when
+ *   BCM needs a bit-plane shifted inside the 64-cycle LSB slot
+ * - MSB first, mode 0 (CPOL=0, CPHA=0)
+ * - Buffer mode: the next register's byte is queued while the current one
+ *   shifts, so the whole chain clocks out back-to-back without byte gaps
+ * - SPI is disabled after init; shift_out() enables it per transfer
+ */
+static void spi_init(void)
+{
+    /* Configure PA1 (MOSI) and PA3 (SCK) as outputs */
+    PORTA.DIRSET = PIN1_bm | PIN3_bm;
+
+    /* Configure SPI master, MSB first, mode 0, but leave disabled */
+    SPI0.CTRLA = SPI_MASTER_bm | SPI_CLOCK_NOW;
+
+    /* Mode 0: CPOL=0, CPHA=0, SSD=1 (client select disable), buffered */
+    SPI0.CTRLB = SPI_BUFEN_bm | SPI_SSD_bm | SPI_MODE_0_gc;
+}
+
+/*
+ * Start shifting a frame out to the 595 chain.
+ * The farthest register's byte goes first. Returns as soon as that byte
+ * is in the transmit buffer; SPI0_INT_vect feeds the rest and pulses the
+ * latch once the last bit has left the shift register.
+ */
+static void spi_start(strip_mask_t frame)
+{
+    spi_busy = 1;
+    spi_frames++;
+    spi_frame = frame;
+    spi_index = CHAIN_LENGTH - 1;
+#if OUTPUT_VERIFY
+    spi_rx_index = CHAIN_LENGTH;
+    spi_rx_error = 0;
+
+    /* Drop receive data left over from BCM or the previous frame */
+    while (SPI0.INTFLAGS & SPI_RXCIF_bm)
+    {
+        (void)SPI0.DATA;
+    }
+#endif
+
+    /* Enable SPI before transfer */
+    SPI0.CTRLA |= SPI_ENABLE_bm;
+
+    /* Ensure latch is low before shifting */
+    PORTA.OUTCLR = LATCH_PIN;
+
+    /* TXCIF is sticky in buffer mode; clear the previous frame's flag */
+    SPI0.INTFLAGS = SPI_TXCIF_bm;
+
+    /* Start SPI transfer */
+    SPI0.DATA = ((const uint8_t *)&spi_frame)[CHAIN_LENGTH - 1];
+
+    /* Keep the buffer fed until the last byte, then wait for completion */
+    SPI0.INTCTRL = (CHAIN_LENGTH > 1) ? SPI_DREIE_bm : SPI_TXCIE_bm;
+}
+
+#if MOTION_CCL
+/*
+ * Route PA2 and a software-strobed event channel through CCL LUT0 onto
+ * the latch pin (LUT0 OUT is PA6). No filter, edge detector or sequencer,
+ * so the LUT is a plain asynchronous gate and needs no clock in sleep.
+ */
+static void motion_ccl_init(void)
+{
+    EVSYS.ASYNCCH1 = EVSYS_ASYNCCH1_OFF_gc;           /* Strobes only */
+    EVSYS.ASYNCUSER2 = EVSYS_ASYNCUSER_ASYNCCH1_gc;   /* LUT0 EVENT0 */
+
+    CCL.LUT0CTRLB = CCL_INSEL0_EVENT0_gc | CCL_INSEL1_MASK_gc;
+    CCL.LUT0CTRLC = CCL_INSEL2_IO_gc;
+    CCL.TRUTH0 = CCL_TRUTH_RCLK;
+    CCL.LUT0CTRLA = CCL_OUTEN_bm | CCL_ENABLE_bm;
+    CCL.CTRLA = CCL_RUNSTDBY_bm | CCL_ENABLE_bm;
+}
+#endif
+
+/*
+ * Queue a frame for the 595 chain and return immediately.
+ * If a transfer is already in flight the frame replaces any frame waiting
+ * in the pending slot, so only the newest state is shifted next.
+ * Must be called with interrupts disabled (from an ISR or before sei()).
+ */
+static void shift_out(strip_mask_t frame)
+{
+    if (spi_busy)
+    {
+        if (spi_pending)
+        {
+            spi_avoided++;
+        }
+
+        spi_pending_frame = frame;
+        spi_pending = 1;
+    }
+    else
+    {
+        spi_start(frame);
+    }
+}
+
+#if OUTPUT_VERIFY
+/*
+ * Compare the bytes QH' has returned so far with the frame the chain held
+ * before this transfer. They come back in the order they were sent:
+ * farthest register first.
+ */
+static inline void spi_verify_rx(void)
+{
+    while (SPI0.INTFLAGS & SPI_RXCIF_bm)
+    {
+        uint8_t rx = SPI0.DATA;
+
+        if (spi_rx_index)
+        {
+            spi_rx_index--;
+
+            if (rx != ((const uint8_t *)&spi_prev_frame)[spi_rx_index])
+            {
+                spi_rx_error = 1;
+            }
+        }
+    }
+}
+
+/*
+ * Frame complete: count a failed readback, drop to the next slower SPI
+ * clock and resend the frame (the corrupted one is already latched).
+ * The resend is not checked, since its readback is the corrupted frame.
+ */
+static inline void spi_verify_done(void)
+{
+    spi_verify_rx();
+
+    if (spi_prev_valid && (spi_rx_error || spi_rx_index))
+    {
+        spi_errors++;
+
+        if (spi_clock_index < SPI_CLOCK_COUNT - 1)
+        {
+            spi_clock_index++;
+        }
+
+        if (!spi_pending)
+        {
+            spi_pending_frame = spi_frame;
+            spi_pending = 1;
+        }
+
+        spi_prev_valid = 0;
+    }
+    else
+    {
+        spi_prev_valid = 1;
+    }
+
+    spi_prev_frame = spi_frame;
+
+    /* Apply a clock change between frames; the enable bit is set again
+     * by spi_start() */
+    SPI0.CTRLA = SPI_MASTER_bm | SPI_CLOCK_NOW;
+}
+
+/*
+ * Shift one byte with polling and return what QH' sent back.
+ */
+static uint8_t spi_exchange(uint8_t data)
+{
+    SPI0.DATA = data;
+
+    while (!(SPI0.INTFLAGS & SPI_RXCIF_bm));
+
+    return SPI0.DATA;
+}
+
+/*
+ * Pick the fastest SPI clock whose QH' readback is intact, at boot.
+ * Shifts two complementary patterns through the chain at each clock and
+ * checks each one comes back on the next pass. The latch is not pulsed,
+ * so the outputs never show the patterns. Falls back to the slowest clock
+ * if none pass.
+ */
+static void spi_autotune(void)
+{
+    uint8_t index;
+
+    for (index = 0; index < SPI_CLOCK_COUNT - 1; index++)
+    {
+        uint8_t ok = 1;
+
+        SPI0.CTRLA = SPI_MASTER_bm | spi_clocks[index] | SPI_ENABLE_bm;
+
+        /* Flush stale receive data */
+        while (SPI0.INTFLAGS & SPI_RXCIF_bm)
+        {
+            (void)SPI0.DATA;
+        }
+
+        for (uint8_t pass = 0; pass < 3; pass++)
+        {
+            uint8_t pattern = (pass & 1) ? 0x5A : 0xA5;
+            uint8_t expect = pattern ^ 0xFF;
+
+            for (uint8_t i = 0; i < CHAIN_LENGTH; i++)
+            {
+                uint8_t rx = spi_exchange(pattern);
+
+                if (pass && rx != expect)
+                {
+                    ok = 0;
+                }
+            }
+        }
+
+        if (ok)
+        {
+            break;
+        }
+    }
+
+    spi_clock_index = index;
+    SPI0.CTRLA = SPI_MASTER_bm | SPI_CLOCK_NOW;
+
+    /* The chain now holds the last 0xA5 pattern */
+    spi_prev_frame = (strip_mask_t)0xA5A5A5A5A5A5A5A5ULL;
+    spi_prev_valid = 1;
+}
+#endif
+
+/*
+ * Transfer complete: latch the chain, then start the pending frame if one
+ * was queued during the transfer, otherwise disable SPI to save power.
+ * With MOTION_CCL a latched frame is followed by the motion preload, and
+ * the preload itself is only latched if PA2 went low while it shifted.
+ */
+static inline void spi_frame_done(void)
+{
+    /* TXCIF must be cleared by writing a one in buffer mode */
+    SPI0.INTFLAGS = SPI_TXCIF_bm;
+
+#if MOTION_CCL
+    uint8_t preloaded = spi_preloading;
+    spi_preloading = 0;
+
+    /* One-cycle strobe on the LUT's event input: RCLK rising edge */
+    if (!preloaded || !(PORTA.IN & MOTION_PIN))
+    {
+        EVSYS.ASYNCSTROBE = EVSYS_ASYNCSTROBE_ASYNCCH1_bm;
+    }
+#else
+    /* Pulse latch pin HIGH to transfer shift register to output register */
+    PORTA.OUTSET = LATCH_PIN;
+    PORTA.OUTCLR = LATCH_PIN;
+#endif
+
+#if OUTPUT_VERIFY
+    spi_verify_done();
+#endif
+
+    if (spi_pending)
+    {
+        spi_pending = 0;
+        spi_start(spi_pending_frame);
+    }
+#if MOTION_CCL
+    else if (!preloaded && (motion_enabled_strips & ~spi_frame))
+    {
+        spi_start(spi_frame | motion_enabled_strips);
+        spi_preloading = 1;
+    }
+#endif
+    else
+    {
+        /* Disable SPI to save power during sleep */
+        SPI0.INTCTRL = 0;
+        SPI0.CTRLA &= ~SPI_ENABLE_bm;
+        spi_busy = 0;
+    }
+}
+
+/*
+ * SPI ISR — data register empty or transfer complete.
+ * DREIF: queue the next register's byte; after the last one switch to
+ *        waiting for transfer complete.
+ * TXCIF: latch the chain, then start the pending frame if one was queued
+ *        during the transfer, otherwise disable SPI to save power.
+ */
+ISR(SPI0_INT_vect)
+{
+    PROFILE_ENTER();
+
+#if OUTPUT_VERIFY
+    spi_verify_rx();
+#endif
+
+    if (SPI0.INTCTRL & SPI_DREIE_bm)
+    {
+        /* Writing DATA clears DREIF */
+        uint8_t index = --spi_index;
+        SPI0.DATA = ((const uint8_t *)&spi_frame)[index];
+
+        if (index == 0)
+        {
+            /* At fast SPI clocks a byte can finish before this ISR feeds
+             * the next, setting TXCIF mid-frame; the last byte is now
+             * shifting, so drop that flag before waiting on it */
+            SPI0.INTFLAGS = SPI_TXCIF_bm;
+            SPI0.INTCTRL = SPI_TXCIE_bm;
+        }
+    }
+    else
+    {
+        spi_frame_done();
+    }
+
+    PROFILE_EXIT(PROFILE_SPI);
+}
+
+#else /* SHIFT_ENGINE_BITBANG */
+
+#define BITBANG_MOSI  PIN1_bm
+#define BITBANG_SCK   PIN3_bm
+
+/* One data bit: set MOSI, then pulse SCK. VPORTA bit ops are single-cycle
+ * SBI/CBI, so each bit is a skip, two MOSI/SCK writes and a jump. */
+#define BITBANG_BIT(data, n)                                    \
+    do {                                                        \
+        if ((data) & (1 << (n))) VPORTA.OUT |= BITBANG_MOSI;    \
+        else VPORTA.OUT &= ~BITBANG_MOSI;                       \
+        VPORTA.OUT |= BITBANG_SCK;                              \
+        VPORTA.OUT &= ~BITBANG_SCK;                             \
+    } while (0)
+
+/*
+ * Configure PA1 (SER) and PA3 (SRCLK) as plain outputs for bit-banging.
+ * SPI0 stays disabled in this build.
+ */
+static void spi_init(void)
+{
+    PORTA.OUTCLR = BITBANG_MOSI | BITBANG_SCK;
+    PORTA.DIRSET = BITBANG_MOSI | BITBANG_SCK;
+}
+
+/*
+ * Clock one byte out MSB first, mode 0 (data valid on the rising edge).
+ */
+static inline void bitbang_byte(uint8_t data)
+{
+    BITBANG_BIT(data, 7);
+    BITBANG_BIT(data, 6);
+    BITBANG_BIT(data, 5);
+    BITBANG_BIT(data, 4);
+    BITBANG_BIT(data, 3);
+    BITBANG_BIT(data, 2);
+    BITBANG_BIT(data, 1);
+    BITBANG_BIT(data, 0);
+}
+
+/*
+ * Shift a frame out to the 595 chain and latch it.
+ * Synchronous, but at ~50 cycles per register it finishes sooner than
+ * an SPI interrupt could be taken.
+ */
+static void shift_out(strip_mask_t frame)
+{
+    spi_frames++;
+
+    for (uint8_t i = CHAIN_LENGTH; i-- > 0; )
+    {
+        bitbang_byte(((const uint8_t *)&frame)[i]);
+    }
+
+    VPORTA.OUT |= LATCH_PIN;
+    VPORTA.OUT &= ~LATCH_PIN;
+}
+
+#endif /* SHIFT_ENGINE */
+
+#if STRIP_BRIGHTNESS
+/* TCA0 period for each bit-plane slot */
+static const uint16_t bcm_period[8] = {
+    (BCM_TICK << 0) - 1, (BCM_TICK << 1) - 1,
+    (BCM_TICK << 2) - 1, (BCM_TICK << 3) - 1,
+    (BCM_TICK << 4) - 1, (BCM_TICK << 5) - 1,
+    (BCM_TICK << 6) - 1, (BCM_TICK << 7) - 1
+};
+
+/*
+ * Shift a bit-plane into the 595 chain without latching it.
+ * Polls DREIF: at CLK_PER/2 a register takes 16 cycles, less than the
+ * cost of taking an SPI interrupt per byte.
+ */
+static inline void bcm_shift(strip_mask_t frame)
+{
+#if SHIFT_ENGINE == SHIFT_ENGINE_SPI
+    SPI0.CTRLA = SPI_MASTER_bm | SPI_CLOCK | SPI_ENABLE_bm;
 
+    for (uint8_t i = CHAIN_LENGTH; i-- > 0; )
+    {
+        while (!(SPI0.INTFLAGS & SPI_DREIF_bm));
+        SPI0.DATA = ((const uint8_t *)&frame)[i];
+    }
+#else
+    for (uint8_t i = CHAIN_LENGTH; i-- > 0; )
+    {
+        bitbang_byte(((const uint8_t *)&frame)[i]);
+    }
+#endif
+}
+
+/*
+ * Start bit-plane scanning on TCA0 (no-op if already running).
+ * BCM owns the chain from here: a shift_out() transfer still in flight is
+ * dropped unlatched, and the MSB plane is preloaded in its place so the
+ * first overflow has a plane to show. That first slot is the shortest;
+ * the MSB slot it latches gets its full length from PERBUF.
+ */
+static void bcm_start(void)
+{
+    if (bcm_running)
+    {
+        return;
+    }
+
+    bcm_running = 1;
+    bcm_plane = 7;
+#if SHIFT_ENGINE == SHIFT_ENGINE_SPI
+    SPI0.INTCTRL = 0;
+    spi_busy = 0;
+    spi_pending = 0;
+#endif
+#if OUTPUT_VERIFY
+    /* Bit-planes are not read back; the chain contents become unknown */
+    spi_prev_valid = 0;
+#endif
+
+    bcm_shift(output_frame & bcm_bits[7]);
+
+    TCA0.SINGLE.CNT = 0;
+    TCA0.SINGLE.PER = bcm_period[0];
+    TCA0.SINGLE.PERBUF = bcm_period[7];
+    TCA0.SINGLE.INTFLAGS = TCA_SINGLE_OVF_bm;
+    TCA0.SINGLE.INTCTRL = TCA_SINGLE_OVF_bm;
+    TCA0.SINGLE.CTRLA = TCA_SINGLE_CLKSEL_DIV1_gc | TCA_SINGLE_ENABLE_bm;
+}
+
+/*
+ * Stop bit-plane scanning; the caller shifts out a static frame next.
+ */
+static void bcm_stop(void)
+{
+    if (!bcm_running)
+    {
+        return;
+    }
+
+    TCA0.SINGLE.CTRLA = 0;
+    TCA0.SINGLE.INTCTRL = 0;
+    bcm_running = 0;
+}
+
+/*
+ * TCA0 overflow ISR — start of a BCM slot.
+ * Latches the plane preloaded during the previous slot and preloads the
+ * next one. PER reloads from PERBUF at each overflow, so the period
+ * queued here is the length of the next slot, the one that shows the
+ * plane being preloaded. Slot timing comes from the timer, so ISR
+ * latency only delays a latch, it never accumulates.
+ */
+ISR(TCA0_OVF_vect)
+{
+    /* Clear the interrupt flag */
+    TCA0.SINGLE.INTFLAGS = TCA_SINGLE_OVF_bm;
+
+    /* Show the preloaded plane */
+    PORTA.OUTSET = LATCH_PIN;
+    PORTA.OUTCLR = LATCH_PIN;
+
+    uint8_t next = (bcm_plane + 1) & 7;
+    bcm_plane = next;
+
+    TCA0.SINGLE.PERBUF = bcm_period[next];
+    bcm_shift(output_frame & bcm_bits[next]);
+}
+#endif
+
+/*
+ * Mark shift_reg_state as changed; output_commit() pushes it later.
+ * Updates landing in the same wake collapse into a single transfer.
+ */
+static inline void output_update(void)
+{
+    if (output_dirty)
+    {
+        spi_avoided++;
+    }
+
+    output_dirty |= OUTPUT_DIRTY;
+}
+
+#if OE_PWM
+/*
+ * Initialize TCA0 single-slope PWM on WO0 (PA7) driving the 595 OE pin.
+ * PIN7CTRL.INVEN makes OE active while WO0 is high, so CMP0 is the duty.
+ * CMP0 = 255 is above PER and never matches, giving 100% on-time.
+ */
+static void oe_pwm_init(void)
+{
+    PORTMUX.CTRLC = PORTMUX_TCA00_bm;
+    PORTA.PIN7CTRL = PORT_INVEN_bm;
+    PORTA.DIRSET = OE_PIN;
+
+    TCA0.SINGLE.PER = 254;
+    TCA0.SINGLE.CMP0 = 0;
+    TCA0.SINGLE.CTRLB = TCA_SINGLE_WGMODE_SINGLESLOPE_gc | TCA_SINGLE_CMP0EN_bm;
+    TCA0.SINGLE.CTRLA = TCA_SINGLE_CLKSEL_DIV64_gc | TCA_SINGLE_ENABLE_bm;
+}
+
+/*
+ * Ramp the OE duty towards a target, one step per PWM period.
+ */
+static void oe_fade(uint8_t target)
+{
+    fade_target = target;
+
+    if (oe_level != target)
+    {
+        TCA0.SINGLE.INTCTRL = TCA_SINGLE_OVF_bm;
+    }
+}
+
+/*
+ * TCA0 overflow ISR — one fade step per PWM period (only while fading).
+ * CMP0BUF is applied at the next overflow, so steps are glitch-free.
+ * When a fade-out finishes, the dispatcher switches off the strips it was
+ * fading.
+ */
+ISR(TCA0_OVF_vect)
+{
+    /* Clear the interrupt flag */
+    TCA0.SINGLE.INTFLAGS = TCA_SINGLE_OVF_bm;
+
+    uint8_t level = oe_level;
+    uint8_t target = fade_target;
+
+    if (level < target)
+    {
+        level = (target - level > OE_FADE_STEP) ? level + OE_FADE_STEP : target;
+    }
+    else
+    {
+        level = (level - target > OE_FADE_STEP) ? level - OE_FADE_STEP : target;
+    }
+
+    oe_level = level;
+    TCA0.SINGLE.CMP0BUF = level;
+
+    if (level == target)
+    {
+        TCA0.SINGLE.INTCTRL = 0;
+
+        if (fade_off_strips)
+        {
+            event_post(EVENT_FADE_DONE);
+        }
+    }
+}
+
+/*
+ * Fade the whole output down, then switch off the given strips.
+ * OE dims every strip, so this only fades if no other strip is lit;
+ * otherwise the strips are cut immediately.
+ */
+static void oe_fade_off(strip_mask_t strip_mask)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (shift_reg_state & ~strip_mask)
+        {
+            shift_reg_state &= ~strip_mask;
+            output_update();
+        }
+        else
+        {
+            fade_off_strips = strip_mask;
+            oe_fade(0);
+        }
+    }
+}
+#endif
+
+/*
+ * True when no ISR is mid-way through the output path (SPI frame, BCM
+ * slot or OE fade step), so the level 1 motion ISR may commit directly.
+ */
+static inline uint8_t output_idle(void)
+{
+    if (spi_busy)
+    {
+        return 0;
+    }
+
+#if STRIP_BRIGHTNESS
+    if (bcm_running)
+    {
+        return 0;
+    }
+#endif
+
+#if OE_PWM
+    if (TCA0.SINGLE.INTCTRL & TCA_SINGLE_OVF_bm)
+    {
+        return 0;
+    }
+#endif
+
+    return 1;
+}
+
+/*
+ * Commit point — push shift_reg_state to the LEDs if it changed.
+ * Called from the main loop with interrupts disabled after every wake,
+ * and from the motion ISR while output_idle().
+ * With STRIP_BRIGHTNESS, strips whose level is 0 or 255 need no modulation;
+ * BCM only runs while a lit strip has a level in between.
+ * With OE_PWM, any update (even one that leaves the frame unchanged, such
+ * as motion retriggering lit strips) cancels a fade-out in progress, and
+ * strips lighting up from dark fade in to oe_brightness.
+ */
+static void output_commit(void)
+{
+    uint8_t dirty = output_dirty;
+    strip_mask_t state = shift_reg_state;
+
+    if (!dirty)
+    {
+        return;
+    }
+
+    output_dirty = 0;
+
+#if MOTION_CCL
+    /* While PA2 is held low the LUT has lit the motion strips; keep them */
+    if (!(PORTA.IN & MOTION_PIN))
+    {
+        state |= motion_enabled_strips;
+        shift_reg_state = state;
+    }
+#endif
+
+#if OE_PWM
+    fade_off_strips = 0;
+
+    if (state)
+    {
+        oe_fade(oe_brightness);
+    }
+    else
+    {
+        /* Nothing lit: park the duty at 0 so the next turn-on fades in */
+        TCA0.SINGLE.INTCTRL = 0;
+        fade_target = 0;
+        oe_level = 0;
+        TCA0.SINGLE.CMP0BUF = 0;
+    }
+#endif
+
+    if (state == output_frame && !(dirty & OUTPUT_FORCE))
+    {
+        spi_avoided++;
+#if ISR_PROFILE
+        motion_timing = 0;
+#endif
+        return;
+    }
+
+    output_frame = state;
+
+#if ISR_PROFILE
+    if (motion_timing)
+    {
+        motion_timing = 0;
+        profile_record(PROFILE_MOTION, motion_stamp);
+    }
+#endif
+
+#if STRIP_BRIGHTNESS
+    strip_mask_t modulated = 0;
+
+    for (uint8_t k = 1; k < 8; k++)
+    {
+        modulated |= (bcm_bits[k] ^ bcm_bits[0]) & state;
+    }
+
+    if (modulated)
+    {
+        bcm_start();
+        return;
+    }
+
+    bcm_stop();
+    shift_out(state & bcm_bits[0]);
+#else
+    shift_out(state);
+#endif
+}
+
+/*
+ * Turn on specific LED strip(s) at the next commit.
+ */
+static inline void strip_on(strip_mask_t strip_mask)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        shift_reg_state |= strip_mask;
+        output_update();
+    }
+}
+
+/*
+ * Turn off specific LED strip(s) at the next commit.
+ */
+static inline void strip_off(strip_mask_t strip_mask)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        shift_reg_state &= ~strip_mask;
+        output_update();
+    }
+}
+
+/*
+ * Set the strip state directly (turns on only the specified strips).
+ */
+static inline void strip_set(strip_mask_t strip_mask)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        shift_reg_state = strip_mask;
+        output_update();
+    }
+}
+
+/*
+ * Toggle specific LED strip(s).
+ */
+static inline void strip_toggle(strip_mask_t strip_mask)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        shift_reg_state ^= strip_mask;
+        output_update();
+    }
+}
+
+/*
+ * Single-strip variants taking a strip index (0 to STRIP_COUNT-1).
+ */
+static inline void strip_on_index(uint8_t strip)
+{
+    strip_on(STRIP_BIT(strip));
+}
+
+static inline void strip_off_index(uint8_t strip)
+{
+    strip_off(STRIP_BIT(strip));
+}
+
+static inline void strip_toggle_index(uint8_t strip)
+{
+    strip_toggle(STRIP_BIT(strip));
+}
+
+#if STRIP_BRIGHTNESS
+/*
+ * Set the brightness (0-255) of specific LED strip(s).
+ * Applies whenever the strip is on; on/off state is unchanged.
+ */
+static inline void strip_brightness(strip_mask_t strip_mask, uint8_t level)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (uint8_t k = 0; k < 8; k++)
+        {
+            if (level & (1 << k))
+            {
+                bcm_bits[k] |= strip_mask;
+            }
+            else
+            {
+                bcm_bits[k] &= ~strip_mask;
+            }
+        }
+
+        output_dirty |= OUTPUT_FORCE;
+    }
+}
+#endif
+
+#if OE_PWM
+/*
+ * Set the global brightness (0-255) of all lit strips, fading to it.
+ */
+static inline void output_brightness(uint8_t level)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        oe_brightness = level;
+
+        if (shift_reg_state)
+        {
+            oe_fade(level);
+        }
+    }
+}
+#endif
+
+/*
+ * Enable strip(s) to respond to motion detection.
+ */
+static inline void strip_motion_enable(strip_mask_t strip_mask)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        motion_enabled_strips |= strip_mask;
+    }
+}
+
+/*
+ * Disable strip(s) from responding to motion detection.
+ */
+static inline void strip_motion_disable(strip_mask_t strip_mask)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        motion_enabled_strips &= ~strip_mask;
+    }
+}
+
+#if SHIFT_BENCHMARK
+/*
+ * Time SHIFT_BENCH_RUNS back-to-back shift_out() calls with TCB0 counting
+ * CLK_PER, including the SPI ISRs and latch. Runs once at boot, before
+ * touch scanning claims TCB0.
+ */
+static void shift_benchmark(void)
+{
+    TCB0.CCMP = 0xFFFF;
+    TCB0.CNT = 0;
+    TCB0.CTRLA = TCB_CLKSEL_CLKDIV1_gc | TCB_ENABLE_bm;
+
+    for (uint8_t i = 0; i < SHIFT_BENCH_RUNS; i++)
+    {
+        cli();
+        shift_out(output_frame);
+        sei();
+
+        while (spi_busy);
+    }
+
+    uint16_t cycles = TCB0.CNT / SHIFT_BENCH_RUNS;
+    TCB0.CTRLA = 0;
+
+    shift_bench_cycles = cycles;
+    shift_bench_us = (uint16_t)(((uint32_t)cycles * 1000000UL) / F_CPU);
+}
+#endif
+
+/*
+ * Initialize the RTC from the internal 32.768 kHz oscillator, leaving TCA0
+ * free for BCM. The counter runs free at RTC_TICKS_PER_SEC (1024 Hz by
+ * default) through standby (PER stays at its 0xFFFF reset value) and only
+ * interrupts on a scheduler deadline.
+ */
+static void rtc_init(void)
+{
+    RTC.CLKSEL = RTC_CLKSEL_INT32K_gc;
+
+    while (RTC.STATUS & RTC_CTRLABUSY_bm);
+    RTC.CTRLA = RTC_PRESCALER | RTC_RUNSTDBY_bm | RTC_RTCEN_bm;
+}
+
+/*
+ * Current time in RTC ticks, extended to 32 bits. timer_program() never
+ * waits longer than half a counter wrap while a timer is armed, so the
+ * elapsed count is never ambiguous. Main-loop context only: no ISR
+ * touches the scheduler, they post EVENT_TIMER instead.
+ */
+static uint32_t timer_now(void)
+{
+    uint16_t cnt = RTC.CNT;
+
+    timer_clock += (uint16_t)(cnt - timer_last_cnt);
+    timer_last_cnt = cnt;
+
+    return timer_clock;
+}
+
+/*
+ * Arm (or re-arm) a timer to expire the given number of ticks from now.
+ * RTC.CMP follows at the next commit point, in timer_program().
+ */
+static void timer_start(uint8_t id, uint16_t ticks)
+{
+    timer_deadline[id] = timer_now() + ticks;
+    timer_armed |= (1 << id);
+}
+
+/*
+ * Cancel a pending timer.
+ */
+static inline void timer_stop(uint8_t id)
+{
+    timer_armed &= ~(1 << id);
+}
+
+/*
+ * Point RTC.CMP at the earliest armed deadline, or turn the compare
+ * interrupt off when nothing is armed. Called from the main loop with
+ * interrupts disabled, right before sleeping, so however many timers the
+ * dispatcher started, the compare is written at most once.
+ */
+static void timer_program(void)
+{
+    uint8_t armed = timer_armed;
+
+    if (!armed)
+    {
+        RTC.INTCTRL = 0;
+        return;
+    }
+
+    uint32_t now = timer_now();
+    int32_t wait = 0x7FFFFFFF;
+
+    for (uint8_t id = 0; id < TIMER_COUNT; id++)
+    {
+        if ((armed & (1 << id)) && (int32_t)(timer_deadline[id] - now) < wait)
+        {
+            wait = (int32_t)(timer_deadline[id] - now);
+        }
+    }
+
+    uint32_t due = now + wait;
+
+    if (!(RTC.INTCTRL & RTC_CMP_bm))
+    {
+        /* CNT passes the stale CMP once per wrap; drop that match */
+        RTC.INTFLAGS = RTC_CMP_bm;
+    }
+    else if (timer_target == due ||
+             ((int32_t)(timer_target - now) > 0 && (int32_t)(timer_target - due) < 0))
+    {
+        /* Already set for this deadline, or for an earlier partial wait.
+         * Leaving it alone matters: re-clamping a near deadline to
+         * TIMER_MIN_LEAD on every wake would push it out indefinitely. */
+        return;
+    }
+
+    if (wait > TIMER_MAX_WAIT)
+    {
+        wait = TIMER_MAX_WAIT;
+    }
+
+    timer_target = now + wait;
+
+    if (wait < TIMER_MIN_LEAD)
+    {
+        wait = TIMER_MIN_LEAD;
+    }
+
+    while (RTC.STATUS & RTC_CMPBUSY_bm);
+    RTC.CMP = (uint16_t)(now + wait);
+    RTC.INTCTRL = RTC_CMP_bm;
+}
+
+/*
+ * Strips whose off-delay is the given class.
+ */
+static strip_mask_t timeout_members(uint8_t c)
+{
+    strip_mask_t members = ALL_LEDS;
+
+#if TIMEOUT_CLASS_BITS
+    for (uint8_t b = 0; b < TIMEOUT_CLASS_BITS; b++)
+    {
+        members &= (c & (1 << b)) ? timeout_class[b] : ~timeout_class[b];
+    }
+#else
+    (void)c;
+#endif
+
+    return members;
+}
+
+/*
+ * Stop the off-delay of strip(s); a class with nothing left counting
+ * down drops its timer.
+ */
+static void timeout_cancel(strip_mask_t strip_mask)
+{
+    timeout_pending &= ~strip_mask;
+
+    for (uint8_t c = 0; c < TIMEOUT_CLASSES; c++)
+    {
+        if (!(timeout_pending & timeout_members(c)))
+        {
+            timer_stop(TIMER_OFF + c);
+        }
+    }
+}
+
+/*
+ * Start the off-delay of strip(s), replacing any countdown in progress.
+ * Each class involved restarts its timer from now.
+ */
+static void timeout_arm(strip_mask_t strip_mask)
+{
+    timeout_cancel(strip_mask);
+
+    for (uint8_t c = 0; c < TIMEOUT_CLASSES; c++)
+    {
+        strip_mask_t armed = strip_mask & timeout_members(c);
+
+        if (armed)
+        {
+            timeout_pending |= armed;
+            timer_start(TIMER_OFF + c, timeout_ticks[c]);
+        }
+    }
+}
+
+/*
+ * Off-delay deadline of one class: turn its strips off. Classes due on
+ * the same wake land in the same commit.
+ */
+static void timeout_expire(uint8_t c)
+{
+    strip_mask_t due = timeout_pending & timeout_members(c);
+
+    timeout_pending &= ~due;
+
+#if OE_PWM
+    oe_fade_off(due);
+#else
+    strip_off(due);
+#endif
+}
+
+/*
+ * Set how long strip(s) stay on after motion stops, in milliseconds,
+ * rounded up to whole RTC ticks (1 to 65535 ticks).
+ * The strips join the class that already has this delay, else a class
+ * no other strip uses. Strips already counting down start over with the
+ * new delay. Returns 0, changing nothing, when every class is taken by
+ * other strips with other delays.
+ */
+static uint8_t strip_timeout_set(strip_mask_t strip_mask, uint32_t ms)
+{
+    /* Clamped first: the multiply wraps from 2^32 / RTC_TICKS_PER_SEC ms */
+    if (ms > MAX_TIMEOUT_MS)
+    {
+        ms = MAX_TIMEOUT_MS;
+    }
+
+    uint16_t ticks = MS_TO_TICKS(ms);
+
+    if (ticks < 1)
+    {
+        ticks = 1;
+    }
+
+    uint8_t pick = TIMEOUT_CLASSES;
+
+    for (uint8_t c = 0; c < TIMEOUT_CLASSES; c++)
+    {
+        strip_mask_t others = timeout_members(c) & ~strip_mask;
+
+        if (others && timeout_ticks[c] == ticks)
+        {
+            pick = c;
+            break;
+        }
+
+        if (!others && pick == TIMEOUT_CLASSES)
+        {
+            pick = c;
+        }
+    }
+
+    if (pick == TIMEOUT_CLASSES)
+    {
+        return 0;
+    }
+
+    timeout_ticks[pick] = ticks;
+
+#if TIMEOUT_CLASS_BITS
+    for (uint8_t b = 0; b < TIMEOUT_CLASS_BITS; b++)
+    {
+        if (pick & (1 << b))
+        {
+            timeout_class[b] |= strip_mask;
+        }
+        else
+        {
+            timeout_class[b] &= ~strip_mask;
+        }
+    }
+#endif
+
+    if (timeout_pending & strip_mask)
+    {
+        timeout_arm(timeout_pending & strip_mask);
+    }
+
+    return 1;
+}
+
+#if TOUCH_SENSING
+/*
+ * Initialize ADC0 for capacitive touch sensing on PA7.
+ * - VDD reference, prescaler /16 (~208 kHz ADC clock)
+ * - 10-bit resolution, TOUCH_ADC_ACC conversions accumulated per start
+ * - PA7 digital input buffer disabled to reduce leakage
+ */
+static void adc_init(void)
+{
+    /* Disable digital input buffer on PA7 to reduce noise */
+    PORTA.PIN7CTRL = PORT_ISC_INPUT_DISABLE_gc;
+
+    /* CTRLC: VDD ref (REFSEL=0x1 in bits 5:4), prescaler /16 (PRESC=0x3 in bits 2:0)
+     * Using explicit hex to rule out define issues with XC8 */
+    ADC0.CTRLC = TOUCH_ADC_CTRLC;
+
+    /* CTRLB: hardware accumulation, RES holds the sum */
+    ADC0.CTRLB = TOUCH_ADC_SAMPNUM;
+
+#if TOUCH_CVD
+    /* 2.5 V internal reference for the S/H precharge (MUXPOS INTREF),
+     * forced on so it is settled whenever it is selected */
+    VREF.CTRLA = VREF_ADC0REFSEL_2V5_gc;
+    VREF.CTRLB = VREF_ADC0REFEN_bm;
+#endif
+
+    /* CTRLA: 10-bit (RESSEL=0, bit 2), enable (bit 0) */
+    ADC0.CTRLA = (1 << 0);  /* = 0x01 */
+
+    /* Keep converting in standby, so scans don't hold the CPU in idle */
+    ADC0.CTRLA |= ADC_RUNSTBY_bm;
+
+    /* Select AIN7 (PA7) */
+    ADC0.MUXPOS = 0x07;
+}
+
+/*
+ * Prepare the pad and the ADC sample-and-hold for the next charge.
+ * Charges the pad by driving HIGH with the S/H parked on GND; once it
+ * floats, charge sharing sets the reading. A finger adds capacitance and
+ * holds more charge → higher reading.
+ * CVD, odd charges: the opposite polarity — pad driven LOW, S/H
+ * precharged to VREF through MUXPOS INTREF. A finger then pulls the
+ * reading down, which touch_accumulate() folds back into the same sense.
+ */
+static void touch_pad_charge(void)
+{
+#if TOUCH_CVD
+    if (touch_charges_left & 1)
+    {
+        ADC0.MUXPOS = ADC_MUXPOS_INTREF_gc;
+
+        PORTA.OUTCLR = TOUCH_PIN;
+        PORTA.DIRSET = TOUCH_PIN;
+        return;
+    }
+#endif
+
+    /* Disconnect ADC from pin during charge to avoid loading the pad */
+    ADC0.MUXPOS = 0x1F;  /* GND — disconnect from AIN7 */
+
+    /* Drive PA7 HIGH to charge the pad */
+    PORTA.DIRSET = TOUCH_PIN;
+    PORTA.OUTSET = TOUCH_PIN;
+}
+
+/*
+ * End a charge: float the pad and start TOUCH_ADC_ACC conversions on it.
+ */
+static void touch_pad_sample(void)
+{
+    /* Switch PA7 to high-Z input (float) */
+    PORTA.DIRCLR = TOUCH_PIN;
+    PORTA.OUTCLR = TOUCH_PIN;
+
+    /* Reconnect ADC and sample immediately */
+    ADC0.MUXPOS = 0x07;  /* AIN7 */
+    ADC0.COMMAND = ADC_STCONV_bm;
+}
+
+/*
+ * Add one charge's accumulated result to the scan sum.
+ * CVD low-polarity results are mirrored (full scale minus result) so that
+ * both halves rise with touch and the sum stays on the 10-bit scale.
+ */
+static void touch_accumulate(uint16_t result)
+{
+#if TOUCH_CVD
+    if (touch_charges_left & 1)
+    {
+        result = TOUCH_CVD_FULL - result;
+    }
+#endif
+
+    touch_sum += result;
+    touch_charges_left--;
+}
+
+/*
+ * Check byte of a baseline record: CRC-8, polynomial 0x07.
+ */
+static uint8_t touch_record_check(const touch_record_t *record)
+{
+    const uint8_t *bytes = (const uint8_t *)record;
+    uint8_t check = 0;
+
+    for (uint8_t i = 0; i < TOUCH_RECORD_SIZE - 1; i++)
+    {
+        check = _crc8_ccitt_update(check, bytes[i]);
+    }
+
+    return check;
+}
+
+/*
+ * Load the persisted baseline and start the background calibration
+ * window. With a valid record touches are detected from the first scan;
+ * without one the window runs blind. Coefficients past the learner's
+ * clamp are not restored, and references outside the part's operating
+ * range are left for the first sensor sample to re-anchor.
+ */
+static void touch_baseline_restore(void)
+{
+    touch_record_t record;
+
+    eeprom_read_block(&record, &touch_record, sizeof(record));
+
+    touch_calib_left = BASELINE_INIT_CYCLES;
+    touch_calib_sum = 0;
+
+    if (record.layout == TOUCH_RECORD_LAYOUT &&
+        record.check == touch_record_check(&record) && record.baseline <= 1023)
+    {
+        touch_baseline = record.baseline;
+        touch_saved = record.baseline;
+        touch_calib_blind = 0;
+#if TOUCH_COMPENSATE
+        if (record.kt >= -TOUCH_COMP_K_MAX && record.kt <= TOUCH_COMP_K_MAX &&
+            record.kv >= -TOUCH_COMP_K_MAX && record.kv <= TOUCH_COMP_K_MAX)
+        {
+            touch_comp_kt = record.kt;
+            touch_comp_kv = record.kv;
+            touch_saved_kt = record.kt;
+            touch_saved_kv = record.kv;
+        }
+
+        if (record.temp_ref >= TOUCH_COMP_TEMP_MIN && record.temp_ref <= TOUCH_COMP_TEMP_MAX &&
+            record.vdd_ref >= TOUCH_COMP_VDD_MIN && record.vdd_ref <= TOUCH_COMP_VDD_MAX)
+        {
+            touch_temp_ref = record.temp_ref;
+            touch_vdd_ref = record.vdd_ref;
+        }
+#endif
+    }
+    else
+    {
+        touch_calib_blind = 1;
+    }
+}
+
+/*
+ * One scan of background calibration: average BASELINE_INIT_CYCLES scans
+ * into the baseline. A restored baseline that is off by a touch threshold
+ * on the first scan is stale (or the pad is held at power-up), and the
+ * window restarts blind. Once detection is live a touch-like reading ends
+ * the window and the baseline is left as it is.
+ * Returns 1 while blind, when the scan must not reach touch_update().
+ */
+static uint8_t touch_calibrate(uint16_t reading)
+{
+    uint16_t baseline = touch_baseline;
+    uint16_t offset = (reading > baseline) ? reading - baseline : baseline - reading;
+
+    if (!touch_calib_blind && offset >= touch_threshold)
+    {
+        if (touch_calib_left != BASELINE_INIT_CYCLES)
+        {
+            touch_calib_left = 0;
+            return 0;
+        }
+
+        touch_calib_blind = 1;
+    }
+
+    if (!touch_calib_blind && (touch_state || touch_debounce_cnt))
+    {
+        touch_calib_left = 0;
+        return 0;
+    }
+
+    touch_calib_sum += reading;
+
+    if (--touch_calib_left == 0)
+    {
+        touch_baseline = touch_calib_sum / BASELINE_INIT_CYCLES;
+        touch_calib_blind = 0;
+        return 0;
+    }
+
+    return touch_calib_blind;
+}
+
+/*
+ * Write the next byte of a pending baseline record, if the EEPROM is free.
+ * One byte per scan keeps the main loop from ever waiting on the ~4 ms
+ * NVM write; the check byte goes last, so a cut-short save reads back
+ * invalid. Unchanged bytes are skipped, costing no wear. The sensor
+ * references are fixed once the first sample sets them.
+ */
+static void touch_save_step(void)
+{
+    if (!touch_save_left || !eeprom_is_ready())
+    {
+        return;
+    }
+
+    touch_record_t record;
+    uint8_t index = TOUCH_RECORD_SIZE - touch_save_left;
+
+    record.baseline = touch_saved;
+#if TOUCH_COMPENSATE
+    record.kt = touch_saved_kt;
+    record.kv = touch_saved_kv;
+    record.temp_ref = touch_temp_ref;
+    record.vdd_ref = touch_vdd_ref;
+#endif
+    record.layout = TOUCH_RECORD_LAYOUT;
+    record.check = touch_record_check(&record);
+
+    eeprom_update_byte((uint8_t *)&touch_record + index, ((const uint8_t *)&record)[index]);
+    touch_save_left--;
+}
+
+/*
+ * Start capacitive touch scanning at the fast ~40 Hz rate (the governor
+ * drops to ~5 Hz, or parks scanning with TOUCH_STANDBY, once idle).
+ * Scan starts are scheduler deadlines; TCB0 (CLK_PER/2, periodic interrupt
+ * mode) only times each 50 us charge phase and is stopped otherwise.
+ * The first TOUCH_SCAN events calibrate (touch_baseline_restore()).
+ */
+static void touch_scan_init(void)
+{
+    touch_phase = TOUCH_GAP;
+    touch_burst_left = TOUCH_BURST_HOLD;
+    ADC0.INTCTRL = ADC_RESRDY_bm;
+
+    TCB0.INTCTRL = TCB_CAPT_bm;
+    timer_start(TIMER_TOUCH, TOUCH_GAP_TICKS);
+}
+
+/*
+ * Begin a charge phase and let TCB0 time the 50 us charge.
+ */
+static void touch_charge_start(void)
+{
+    touch_pad_charge();
+
+    touch_phase = TOUCH_CHARGING;
+    TCB0.CCMP = TOUCH_CHARGE_TOP;
+    TCB0.CNT = 0;
+    TCB0.CTRLA = TCB_CLKSEL_CLKDIV2_gc | TCB_ENABLE_bm;
+}
+
+#if TOUCH_STANDBY
+/*
+ * Switch idle scanning to parked scans and arm the ADC window comparator
+ * around the baseline. Parked scans are one charge, so the window is on
+ * the TOUCH_ADC_ACC accumulated scale.
+ */
+static void touch_park(void)
+{
+    uint16_t baseline = touch_baseline;
+#if TOUCH_COMPENSATE
+    /* The comparator sees raw results */
+    baseline += touch_comp;
+#endif
+    uint8_t threshold = touch_threshold;
+    uint16_t low = (baseline > threshold) ? baseline - threshold : 0;
+    uint16_t high = baseline + (threshold >> 1);
+
+    /* Keep both limits on the 10-bit scale so they fit RES at ACC64 */
+    if (high > 1023)
+    {
+        high = 1023;
+    }
+
+    if (low > 1023)
+    {
+        low = 1023;
+    }
+
+    timer_start(TIMER_TOUCH, TOUCH_PARK_TICKS);
+
+    ADC0.WINLT = low * TOUCH_ADC_ACC;
+    ADC0.WINHT = high * TOUCH_ADC_ACC;
+    ADC0.CTRLE = ADC_WINCM_OUTSIDE_gc;
+    ADC0.INTCTRL = ADC_WCMP_bm;
+
+    touch_parked = 1;
+}
+
+/*
+ * Leave parked mode: window comparator off, full scans report through
+ * RESRDY again. The dispatcher schedules the next scan.
+ */
+static void touch_unpark(void)
+{
+    touch_parked = 0;
+
+    ADC0.CTRLE = ADC_WINCM_NONE_gc;
+    ADC0.INTFLAGS = ADC_RESRDY_bm | ADC_WCMP_bm;
+    ADC0.INTCTRL = ADC_RESRDY_bm;
+
+    touch_phase = TOUCH_GAP;
+}
+#endif
+
+/*
+ * Scan deadline: start the first charge of a new scan. A parked scan is a
+ * single charge whose conversion only the window comparator looks at, so
+ * the next one is scheduled right away.
+ */
+static void touch_scan_start(void)
+{
+#if TOUCH_COMPENSATE
+    /* A sensor sample still has ADC0 (a ~20 ms gap makes this rare) */
+    if (touch_phase >= TOUCH_SENSOR_SETTLE)
+    {
+        timer_start(TIMER_TOUCH, MS_TO_TICKS(2));
+        return;
+    }
+#endif
+
+#if TOUCH_STANDBY
+    if (touch_parked)
+    {
+        timer_start(TIMER_TOUCH, TOUCH_PARK_TICKS);
+        touch_charges_left = 0;
+        touch_charge_start();
+        return;
+    }
+#endif
+
+    touch_sum = 0;
+    touch_charges_left = TOUCH_CHARGES;
+    touch_charge_start();
+}
+#endif
+
+/*
+ * PA2 pin-change ISR — fires on both edges of the motion sensor output.
+ * Runs at CPUINT level 1, so it preempts touch scanning and every other
+ * ISR. Lights the motion strips whenever motion_edge() will (any start,
+ * or a stop with no start seen) and commits them on the spot if the
+ * output path is idle; otherwise the main loop's commit picks them up
+ * once the frame in flight is latched. Then posts the level the line
+ * has now; motion_edge() does the timeout bookkeeping.
+ * With MOTION_CCL only the rising edge interrupts: the strips are already
+ * lit by the LUT, and motion_active stays 0, so every stop relights them
+ * in the firmware's frame and arms the timeouts.
+ */
+ISR(PORTA_PORT_vect)
+{
+    PROFILE_ENTER();
+
+    /* Clear the interrupt flag */
+    PORTA.INTFLAGS = MOTION_PIN;
+
+    uint8_t detected = !(PORTA.IN & MOTION_PIN);
+
+    if (detected || !motion_active)
+    {
+#if ISR_PROFILE
+        motion_stamp = profile_start;
+        motion_timing = 1;
+#endif
+        shift_reg_state |= motion_enabled_strips;
+        output_update();
+#if MOTION_CCL
+        /* The LUT latched behind the firmware's back: resend the frame */
+        output_dirty |= OUTPUT_FORCE;
+#endif
+
+        if (output_idle())
+        {
+            output_commit();
+        }
+    }
+
+    motion_level = detected;
+    event_post(EVENT_MOTION);
+
+    PROFILE_EXIT(PROFILE_PORTA);
+}
+
+/*
+ * RTC compare ISR — the earliest scheduler deadline may be due.
+ * Turns the compare interrupt off, so it can't fire again before the
+ * main loop runs the due timers and reprograms RTC.CMP.
+ */
+ISR(RTC_CNT_vect)
+{
+    PROFILE_ENTER();
+
+    /* Clear the interrupt flag */
+    RTC.INTFLAGS = RTC_CMP_bm;
+    RTC.INTCTRL = 0;
+
+    event_post(EVENT_TIMER);
+
+    PROFILE_EXIT(PROFILE_RTC);
+}
+
+#if TOUCH_SENSING
+/*
+ * Fold an untouched reading into the noise estimate and retune the
+ * threshold from it. Deviations are capped at the current threshold, so
+ * a touch starting to build up can't inflate the estimate.
+ */
+static void touch_noise_update(uint16_t reading, uint16_t baseline)
+{
+    uint8_t threshold = touch_threshold;
+    uint16_t dev = (reading > baseline) ? reading - baseline : baseline - reading;
+
+    if (dev > threshold)
+    {
+        dev = threshold;
+    }
+
+    touch_noise += ((int16_t)(dev << 8) - (int16_t)touch_noise) >> TOUCH_NOISE_SHIFT;
+
+    uint16_t level = ((uint32_t)touch_noise * TOUCH_SNR) >> 8;
+
+    if (level < TOUCH_THRESHOLD_MIN)
+    {
+        level = TOUCH_THRESHOLD_MIN;
+    }
+    else if (level > TOUCH_THRESHOLD_MAX)
+    {
+        level = TOUCH_THRESHOLD_MAX;
+    }
+
+    touch_threshold = (uint8_t)level;
+}
+
+/*
+ * Process one filtered touch reading.
+ * Compares against adaptive baseline, debounces state changes with
+ * hysteresis, and toggles all LEDs on touch/release. A touch held past
+ * TOUCH_MAX_HOLD_TICKS is released and the baseline recalibrated.
+ */
+static void touch_update(uint16_t reading)
+{
+    uint16_t baseline = touch_baseline;
+    uint8_t threshold = touch_threshold;
+    uint16_t rise = (reading > baseline) ? reading - baseline : 0;
+
+    if (touch_state && timer_now() - touch_since >= TOUCH_MAX_HOLD_TICKS)
+    {
+        touch_stuck++;
+        touch_state = 0;
+        touch_debounce_cnt = 0;
+        touch_baseline = reading;
+        strip_off(ALL_LEDS);
+        return;
+    }
+
+    /* Touch INCREASES reading (finger holds charge longer on this pad);
+     * once touched it holds until the rise drops below half the level */
+    uint8_t tentative = rise >= (touch_state ? (threshold >> 1) : threshold);
+
+    if (tentative != touch_state)
+    {
+        touch_debounce_cnt++;
+
+        if (touch_debounce_cnt >= TOUCH_DEBOUNCE)
+        {
+            touch_state = tentative;
+            touch_debounce_cnt = 0;
+
+            if (touch_state)
+            {
+                touch_since = timer_now();
+                touch_events++;
+                strip_on(ALL_LEDS);
+            }
+            else
+            {
+                strip_off(ALL_LEDS);
+            }
+        }
+    }
+    else
+    {
+        touch_debounce_cnt = 0;
+    }
+
+    /* Adaptive baseline: slowly track readings when not touched. Held
+     * while a touch is being debounced, or the fast burst rate would
+     * pull the baseline into the touch it is about to confirm, and for
+     * the first reading of a threshold-sized jump, whose sensor sample
+     * comes in before the next scan, or a supply step would drag it
+     * (fast, if it looks stale) before the correction catches up.
+     * Readings still that far off after it, and smaller jumps, are
+     * tracked: a stuck touch's baseline has to recover once the pad is
+     * clear, and a slow temperature swing must not stall it. */
+    uint8_t hold = touch_state || touch_debounce_cnt;
+#if TOUCH_COMPENSATE
+    hold |= (touch_comp_jump == 1);
+#endif
+
+    if (!hold)
+    {
+        uint8_t stale = reading + threshold < baseline;
+        uint8_t shift = stale ? BASELINE_SHIFT_STALE
+                      : touch_burst_left ? BASELINE_SHIFT : BASELINE_SHIFT_SLOW;
+
+        /* 8.8 step with the fraction carried over, so offsets smaller
+         * than 1 << shift are tracked too */
+        int32_t step = ((int32_t)((int16_t)reading - (int16_t)baseline) << 8) >> shift;
+
+        step += touch_baseline_frac;
+        touch_baseline += (int16_t)(step >> 8);
+        touch_baseline_frac = (uint8_t)step;
+
+        if (!stale)
+        {
+            touch_noise_update(reading, baseline);
+        }
+    }
+
+    /* Scan-rate governor: stay fast while anything touch-like is going on */
+    if (touch_state || touch_debounce_cnt || rise >= (threshold >> 1))
+    {
+        touch_burst_left = TOUCH_BURST_HOLD;
+    }
+    else if (touch_burst_left)
+    {
+        touch_burst_left--;
+    }
+}
 
+#if TOUCH_COMPENSATE
 /*
- * Initialize SPI in master mode for 74HC595 communication.
- * - PA1 (MOSI): Serial data out
- * - PA3 (SCK): Clock
- * - CLK_PER/64 = ~52 kHz (slower for reliability)
- * - MSB first, mode 0 (CPOL=0, CPHA=0)
- * - SPI is disabled after init; shift_out() enables it per transfer
+ * Start a temperature/VDD sample between scans: switch ADC0 to the 1.1 V
+ * reference and let TCB0 time its start-up. touch_sensor_step() runs the
+ * conversions from the ISRs, so the CPU sleeps through them.
  */
-static void spi_init(void)
+static void touch_sensor_start(void)
 {
-    /* Configure PA1 (MOSI) and PA3 (SCK) as outputs */
-    PORTA.DIRSET = PIN1_bm | PIN3_bm;
+    VREF.CTRLA = (VREF.CTRLA & ~VREF_ADC0REFSEL_gm) | VREF_ADC0REFSEL_1V1_gc;
+    ADC0.SAMPCTRL = TOUCH_SENSOR_SAMPLEN;
 
-    /* Configure SPI master, MSB first, mode 0, CLK/64, but leave disabled */
-    SPI0.CTRLA = SPI_MASTER_bm | SPI_PRESC_DIV64_gc;
-
-    /* Mode 0: CPOL=0, CPHA=0, SSD=1 (client select disable) */
-    SPI0.CTRLB = SPI_SSD_bm | SPI_MODE_0_gc;
+    touch_phase = TOUCH_SENSOR_SETTLE;
+    TCB0.CCMP = TOUCH_SENSOR_SETTLE_TOP;
+    TCB0.CNT = 0;
+    TCB0.CTRLA = TCB_CLKSEL_CLKDIV2_gc | TCB_ENABLE_bm;
 }
 
 /*
- * Shift out a byte to the 74HC595 and latch it.
- * Updates the shift register outputs immediately.
- * Disables SPI after transfer to save power during sleep.
+ * Next step of a sensor sample, ISR context: the reference has started
+ * (TCB0) or a conversion is done (RESRDY). 1.1 V against VDD, then the
+ * temperature sensor against 1.1 V; then ADC0 gets the pad's settings
+ * back and the results are posted as EVENT_TOUCH_SENSORS.
  */
-static void shift_out(uint8_t data)
+static void touch_sensor_step(void)
 {
-    /* Enable SPI before transfer */
-    SPI0.CTRLA |= SPI_ENABLE_bm;
-
-    /* Ensure latch is low before shifting */
-    PORTA.OUTCLR = LATCH_PIN;
+    switch (touch_phase)
+    {
+    case TOUCH_SENSOR_SETTLE:
+        ADC0.CTRLC = ADC_REFSEL_VDDREF_gc | (TOUCH_ADC_CTRLC & ADC_PRESC_gm);
+        ADC0.MUXPOS = ADC_MUXPOS_INTREF_gc;
+        touch_phase = TOUCH_SENSOR_VDD;
+        break;
+    case TOUCH_SENSOR_VDD:
+        touch_vdd_raw = ADC0.RES;
+        ADC0.CTRLC = ADC_SAMPCAP_bm | ADC_REFSEL_INTREF_gc | (TOUCH_ADC_CTRLC & ADC_PRESC_gm);
+        ADC0.MUXPOS = ADC_MUXPOS_TEMPSENSE_gc;
+        touch_phase = TOUCH_SENSOR_TEMP;
+        break;
+    default:
+        touch_temp_raw = ADC0.RES;
+        ADC0.CTRLC = TOUCH_ADC_CTRLC;
+        ADC0.SAMPCTRL = 0;
+#if TOUCH_CVD
+        VREF.CTRLA = (VREF.CTRLA & ~VREF_ADC0REFSEL_gm) | VREF_ADC0REFSEL_2V5_gc;
+#else
+        VREF.CTRLA &= ~VREF_ADC0REFSEL_gm;
+#endif
+        touch_phase = TOUCH_GAP;
+        event_post(EVENT_TOUCH_SENSORS);
+        return;
+    }
 
-    /* Clear any previous SPI interrupt flag */
-    SPI0.INTFLAGS = SPI_IF_bm;
+    ADC0.COMMAND = ADC_STCONV_bm;
+}
+#endif
 
-    /* Start SPI transfer */
-    SPI0.DATA = data;
+/*
+ * TCB0 capture ISR — end of a 50 us charge phase.
+ * Stops TCB0, floats the pad and starts the accumulated conversion;
+ * ADC0_RESRDY_vect takes it from there. With TOUCH_COMPENSATE it also
+ * ends a sensor sample's reference start-up.
+ */
+ISR(TCB0_INT_vect)
+{
+    PROFILE_ENTER();
 
-    /* Wait for transfer complete */
-    while (!(SPI0.INTFLAGS & SPI_IF_bm));
+    /* Clear the interrupt flag */
+    TCB0.INTFLAGS = TCB_CAPT_bm;
 
-    /* Clear the flag */
-    SPI0.INTFLAGS = SPI_IF_bm;
+    TCB0.CTRLA = TCB_CLKSEL_CLKDIV2_gc;
 
-    /* Pulse latch pin HIGH to transfer shift register to output register */
-    PORTA.OUTSET = LATCH_PIN;
-    PORTA.OUTCLR = LATCH_PIN;
+    if (touch_phase == TOUCH_CHARGING)
+    {
+        touch_pad_sample();
+        touch_phase = TOUCH_CONVERTING;
+    }
+#if TOUCH_COMPENSATE
+    else
+    {
+        touch_sensor_step();
+    }
+#endif
 
-    /* Disable SPI to save power during sleep */
-    SPI0.CTRLA &= ~SPI_ENABLE_bm;
+    PROFILE_EXIT(PROFILE_TCB0);
 }
 
 /*
- * Turn on specific LED strip(s) immediately.
+ * ADC result-ready ISR — TOUCH_ADC_ACC conversions of one charge are done.
+ * Adds them to the scan sum and starts the next charge, or finishes the
+ * scan and posts the reading for touch_scan_done(). A sensor sample's
+ * conversions go to touch_sensor_step().
  */
-static inline void strip_on(uint8_t strip_mask)
+ISR(ADC0_RESRDY_vect)
 {
-    shift_reg_state |= strip_mask;
-    shift_out(shift_reg_state);
+    PROFILE_ENTER();
+
+#if TOUCH_COMPENSATE
+    if (touch_phase != TOUCH_CONVERTING)
+    {
+        touch_sensor_step();
+        PROFILE_EXIT(PROFILE_ADC);
+        return;
+    }
+#endif
+
+    /* Reading clears the flag */
+    touch_accumulate(ADC0.RES);
+
+    if (touch_charges_left)
+    {
+        touch_charge_start();
+    }
+    else
+    {
+        touch_phase = TOUCH_GAP;
+        touch_reading = touch_sum >> TOUCH_SAMPLE_SHIFT;
+        event_post(EVENT_TOUCH_SCAN);
+    }
+
+    PROFILE_EXIT(PROFILE_ADC);
 }
 
+#if TOUCH_STANDBY
 /*
- * Turn off specific LED strip(s) immediately.
+ * ADC window compare ISR — a parked scan left the baseline window.
+ * Wakes from standby and unparks the ADC at once, so no further window
+ * match can post; the dispatcher schedules the fast scans that debounce
+ * a touch or let the baseline catch up with drift before parking again.
+ * The charge's result goes along, so a touch-level one can count as the
+ * first debounce reading.
  */
-static inline void strip_off(uint8_t strip_mask)
+ISR(ADC0_WCOMP_vect)
 {
-    shift_reg_state &= ~strip_mask;
-    shift_out(shift_reg_state);
+    PROFILE_ENTER();
+
+    touch_reading = ADC0.RES / TOUCH_ADC_ACC;
+    touch_unpark();
+    event_post(EVENT_TOUCH_WAKE);
+
+    PROFILE_EXIT(PROFILE_ADC);
 }
+#endif
 
+#if TOUCH_COMPENSATE
 /*
- * Set the strip state directly (turns on only the specified strips).
+ * Clamp a coefficient to +-TOUCH_COMP_K_MAX.
  */
-static inline void strip_set(uint8_t strip_mask)
+static int16_t touch_comp_clamp(int32_t k)
 {
-    shift_reg_state = strip_mask;
-    shift_out(shift_reg_state);
+    if (k > TOUCH_COMP_K_MAX)
+    {
+        return TOUCH_COMP_K_MAX;
+    }
+
+    if (k < -TOUCH_COMP_K_MAX)
+    {
+        return -TOUCH_COMP_K_MAX;
+    }
+
+    return (int16_t)k;
 }
 
-/*
- * Toggle specific LED strip(s).
- */
-static inline void strip_toggle(uint8_t strip_mask)
+/* A sensor move that can teach, clamped to int8_t, else 0 */
+static int8_t touch_comp_move8(int16_t move)
+{
+    if (move < TOUCH_COMP_MOVE && move > -TOUCH_COMP_MOVE)
+    {
+        return 0;
+    }
+
+    return (int8_t)((move > 127) ? 127 : (move < -127) ? -127 : move);
+}
+
+/* Recompute the correction from the coefficients and the last sample */
+static void touch_comp_apply(void)
 {
-    shift_reg_state ^= strip_mask;
-    shift_out(shift_reg_state);
+    int32_t comp = (int32_t)touch_comp_kt * touch_temp_delta +
+                   (int32_t)touch_comp_kv * touch_vdd_delta;
+
+    touch_comp = (int16_t)((comp + 0x80) >> 8);
 }
 
 /*
- * Enable strip(s) to respond to motion detection.
+ * Step a coefficient by TOUCH_COMP_STEP towards cancelling a residual,
+ * up when it shares a sign with the sensor's move. Moves within the
+ * sensor's noise teach nothing. Small residuals are whole counts read
+ * against a baseline still catching up, so only their sign is trusted.
  */
-static inline void strip_motion_enable(uint8_t strip_mask)
+static int16_t touch_comp_learn(int16_t k, int16_t err, int16_t move)
 {
-    motion_enabled_strips |= strip_mask;
+    if (move < TOUCH_COMP_MOVE && move > -TOUCH_COMP_MOVE)
+    {
+        return k;
+    }
+
+    return touch_comp_clamp(k + (((err > 0) == (move > 0)) ? TOUCH_COMP_STEP : -TOUCH_COMP_STEP));
 }
 
 /*
- * Disable strip(s) from responding to motion detection.
+ * Move a coefficient to cancel a residual the sensor's move explains, or
+ * 1 / 2^shift of the way: half when the other sensor moved too, so the
+ * two together don't overshoot.
  */
-static inline void strip_motion_disable(uint8_t strip_mask)
+static int16_t touch_comp_fit(int16_t k, int16_t err, int16_t move, uint8_t shift)
 {
-    motion_enabled_strips &= ~strip_mask;
+    return touch_comp_clamp(k + ((int32_t)err << (8 - shift)) / move);
 }
 
 /*
- * Initialize ADC0 for capacitive touch sensing on PA7.
- * - VDD reference, prescaler /16 (~208 kHz ADC clock)
- * - 10-bit resolution, single conversion mode
- * - PA7 digital input buffer disabled to reduce leakage
+ * A held rise let go: it was drift if the sensor went back by
+ * TOUCH_COMP_MOVE the way it came (rise is how far it went, or 0). Its
+ * error was a touch threshold or more, large enough to fit.
  */
-static void adc_init(void)
+static int16_t touch_comp_settle(int16_t k, int8_t rise, int16_t move, uint8_t shift)
 {
-    /* Disable digital input buffer on PA7 to reduce noise */
-    PORTA.PIN7CTRL = PORT_ISC_INPUT_DISABLE_gc;
-
-    /* CTRLC: VDD ref (REFSEL=0x1 in bits 5:4), prescaler /16 (PRESC=0x3 in bits 2:0)
-     * Using explicit hex to rule out define issues with XC8 */
-    ADC0.CTRLC = (0x01 << 4) | (0x03 << 0);  /* = 0x13 */
-
-    /* CTRLA: 10-bit (RESSEL=0, bit 2), enable (bit 0) */
-    ADC0.CTRLA = (1 << 0);  /* = 0x01 */
+    if (!rise || ((rise > 0) ? (move > -TOUCH_COMP_MOVE) : (move < TOUCH_COMP_MOVE)))
+    {
+        return k;
+    }
 
-    /* Select AIN7 (PA7) */
-    ADC0.MUXPOS = 0x07;
+    return touch_comp_fit(k, touch_comp_rise_err, rise, shift);
 }
 
 /*
- * Take a single capacitive touch reading on PA7.
- * Charges the pad by driving HIGH, then floats and samples with ADC.
- * A finger adds capacitance, draining charge faster → lower reading.
+ * A sensor sample is in (EVENT_TOUCH_SENSORS): learn from what the last
+ * correction missed and recompute it. touch_comp_offset is how far the
+ * reading that asked for the sample sat off the baseline, TOUCH_COMP_RELEASE
+ * when a held rise dropped back, else 0.
  */
-static uint16_t touch_measure_once(void)
+static void touch_comp_update(uint16_t vdd_raw, uint16_t temp_raw)
 {
-    /* Disconnect ADC from pin during charge to avoid loading the pad */
-    ADC0.MUXPOS = 0x1F;  /* GND — disconnect from AIN7 */
+    int16_t offset = touch_comp_offset;
+    uint8_t clean = touch_comp_clean;
+    uint16_t sum = touch_comp_sum;
 
-    /* Drive PA7 HIGH to charge the pad */
-    PORTA.DIRSET = TOUCH_PIN;
-    PORTA.OUTSET = TOUCH_PIN;
+    touch_comp_offset = 0;
+    touch_comp_clean = 0;
+    touch_comp_sum = 0;
 
-    /* Longer charge time for reliable charging */
-    _delay_us(50);
+    if (!vdd_raw)
+    {
+        return;
+    }
 
-    /* Switch PA7 to high-Z input (float) */
-    PORTA.DIRCLR = TOUCH_PIN;
-    PORTA.OUTCLR = TOUCH_PIN;
+    /* VDD = 1.1 V * 1023 / result, in 10 mV */
+    uint16_t vdd = (uint16_t)((110UL * 1023 * TOUCH_ADC_ACC) / vdd_raw);
 
-    /* Reconnect ADC and sample immediately */
-    ADC0.MUXPOS = 0x07;  /* AIN7 */
+    /* Datasheet conversion: (result - offset) * gain / 256 kelvin */
+    int16_t temp_adc = (int16_t)(temp_raw / TOUCH_ADC_ACC) - (int8_t)SIGROW.TEMPSENSE1;
+    uint16_t kelvin = (uint16_t)(((uint32_t)(uint16_t)temp_adc * SIGROW.TEMPSENSE0 + 0x80) >> 8);
 
-    /* Start ADC conversion */
-    ADC0.COMMAND = ADC_STCONV_bm;
+    if (!touch_temp_ref)
+    {
+        touch_temp_ref = kelvin;
+        touch_vdd_ref = vdd;
+    }
 
-    /* Wait for conversion complete */
-    while (!(ADC0.INTFLAGS & ADC_RESRDY_bm));
+    int16_t temp_delta = (int16_t)(kelvin - touch_temp_ref);
+    int16_t vdd_delta = (int16_t)(vdd - touch_vdd_ref);
+    int16_t temp_move = temp_delta - touch_temp_delta;
+    int16_t vdd_move = vdd_delta - touch_vdd_delta;
 
-    /* Reading clears the flag */
-    return ADC0.RES;
+    if (offset == TOUCH_COMP_RELEASE)
+    {
+        uint8_t shared = touch_comp_rise_temp && touch_comp_rise_vdd;
+
+        touch_comp_kt = touch_comp_settle(touch_comp_kt, touch_comp_rise_temp, temp_move, shared);
+        touch_comp_kv = touch_comp_settle(touch_comp_kv, touch_comp_rise_vdd, vdd_move, shared);
+        touch_comp_rise_temp = 0;
+        touch_comp_rise_vdd = 0;
+    }
+    else if (offset)
+    {
+        /* A jump. If the sensors moved, the next reading, all of it
+         * taken under the new correction, shows what that leaves. */
+        touch_comp_check_temp = touch_comp_move8(temp_move);
+        touch_comp_check_vdd = touch_comp_move8(vdd_move);
+    }
+    else if (!touch_calib_left && clean == TOUCH_COMP_SCANS &&
+             temp_move < TOUCH_COMP_MOVE && temp_move > -TOUCH_COMP_MOVE &&
+             vdd_move < TOUCH_COMP_MOVE && vdd_move > -TOUCH_COMP_MOVE)
+    {
+        /* A steady untouched window. Against the last one, whatever the
+         * correction doesn't account for in the change of raw sums is
+         * the coefficients' error. */
+        if (touch_comp_prev)
+        {
+            int16_t temp_step = touch_temp_delta - touch_comp_prev_temp;
+            int16_t vdd_step = touch_vdd_delta - touch_comp_prev_vdd;
+            int32_t expect = ((int32_t)touch_comp_kt * temp_step +
+                              (int32_t)touch_comp_kv * vdd_step) * TOUCH_COMP_SCANS;
+            int16_t err = (int16_t)(sum - touch_comp_prev) - (int16_t)((expect + 0x80) >> 8);
+            uint16_t mag = (err > 0) ? err : -err;
+
+            if (mag > (((uint32_t)touch_noise * TOUCH_COMP_SCANS) >> 8))
+            {
+                touch_comp_kt = touch_comp_learn(touch_comp_kt, err, temp_step);
+                touch_comp_kv = touch_comp_learn(touch_comp_kv, err, vdd_step);
+            }
+        }
+
+        touch_comp_prev = sum;
+        touch_comp_prev_temp = touch_temp_delta;
+        touch_comp_prev_vdd = touch_vdd_delta;
+    }
+
+    touch_temp_delta = temp_delta;
+    touch_vdd_delta = vdd_delta;
+    touch_comp_apply();
 }
 
 /*
- * Take TOUCH_SAMPLES readings and return the average.
- * Reduces noise for more reliable touch detection.
+ * The first reading after a jump's sample, corrected under the sample:
+ * err is how far it sits off the baseline, what the correction left of
+ * the sensors' move. A threshold or more may be a finger, so it is held
+ * until it lets go; past the noise and a count of rounding either way,
+ * it teaches, fitted once the move is TOUCH_COMP_SPAN.
  */
-static uint16_t touch_measure_filtered(void)
+static void touch_comp_check(int16_t err)
 {
-    uint16_t sum = 0;
+    int8_t temp = touch_comp_check_temp;
+    int8_t vdd = touch_comp_check_vdd;
+    uint16_t mag = (err > 0) ? err : -err;
+
+    touch_comp_check_temp = 0;
+    touch_comp_check_vdd = 0;
+
+    if (touch_state || touch_calib_left)
+    {
+        return;
+    }
 
-    for (uint8_t i = 0; i < TOUCH_SAMPLES; i++)
+    if (err >= (int16_t)touch_threshold)
     {
-        sum += touch_measure_once();
+        touch_comp_rise_temp = temp;
+        touch_comp_rise_vdd = vdd;
+        touch_comp_rise_err = err;
+        return;
     }
 
-    return sum >> 6;  /* Divide by 64 (TOUCH_SAMPLES) */
+    if (mag <= (touch_noise >> 8) + 1)
+    {
+        return;
+    }
+
+    /* Half way, so one reading's noise and baseline lag don't swing a
+     * learned coefficient; all the way for one still at 0 */
+    uint8_t shared = temp && vdd;
+
+    touch_comp_kt = (temp >= TOUCH_COMP_SPAN || temp <= -TOUCH_COMP_SPAN)
+                  ? touch_comp_fit(touch_comp_kt, err, temp, shared + (touch_comp_kt != 0))
+                  : touch_comp_learn(touch_comp_kt, err, temp);
+    touch_comp_kv = (vdd >= TOUCH_COMP_SPAN || vdd <= -TOUCH_COMP_SPAN)
+                  ? touch_comp_fit(touch_comp_kv, err, vdd, shared + (touch_comp_kv != 0))
+                  : touch_comp_learn(touch_comp_kv, err, vdd);
+    touch_comp_apply();
 }
 
 /*
- * Initialize TCB0 for periodic capacitive touch scanning at ~40 Hz.
- * Uses CLK_PER/2 prescaler in periodic interrupt mode.
+ * Correct a scan reading, resampling the sensors when the window is up
+ * or the reading jumps, and sum untouched readings for
+ * touch_comp_update() to learn from.
  */
-static void tcb0_init(void)
+static uint16_t touch_compensate(uint16_t reading)
 {
-    TCB0.CCMP = TCB_SCAN_TOP;
-    TCB0.CTRLA = TCB_CLKSEL_CLKDIV2_gc | TCB_ENABLE_bm;
-    TCB0.INTCTRL = TCB_CAPT_bm;
+    if (touch_comp_check_temp || touch_comp_check_vdd)
+    {
+        touch_comp_check((int16_t)reading - touch_comp - (int16_t)touch_baseline);
+    }
+
+    int16_t corrected = (int16_t)reading - touch_comp;
+    int16_t offset = corrected - (int16_t)touch_baseline;
+    uint8_t band = touch_threshold >> 1;
+
+    /* Off the baseline by half the threshold either way: a touch, or a
+     * step the correction hasn't caught up with */
+    uint8_t excursion = !touch_state && !touch_calib_left &&
+                        (offset >= band || offset <= -(int16_t)band);
+
+    touch_comp_jump = (!excursion || (offset < (int16_t)touch_threshold &&
+                                      offset > -(int16_t)touch_threshold)) ? 0
+                    : touch_comp_jump ? 2 : 1;
+
+    if (!touch_state && !touch_debounce_cnt)
+    {
+        touch_comp_sum += reading;
+        touch_comp_clean++;
+    }
+
+    /* A held rise dropped back under half the threshold */
+    uint8_t release = (touch_comp_rise_temp || touch_comp_rise_vdd) && offset < (int16_t)band;
+
+    /* The sample closes the window with this reading in it; it is in
+     * before the next scan, so this reading keeps the old correction */
+    if (!touch_comp_left || excursion || release)
+    {
+        touch_comp_offset = release ? TOUCH_COMP_RELEASE : excursion ? offset : 0;
+        touch_comp_left = TOUCH_COMP_SCANS;
+        touch_sensor_start();
+    }
+
+    touch_comp_left--;
+
+    return (corrected > 0) ? (uint16_t)corrected : 0;
 }
+#endif
 
 /*
- * PA2 pin-change ISR — fires on falling edge (motion detected).
- * Turns on motion-enabled LED strips and resets the timeout.
+ * Scan finished: calibrate or evaluate the reading, persist a baseline
+ * that drifted by TOUCH_SAVE_DELTA (or coefficients that moved by
+ * TOUCH_SAVE_K_DELTA), and schedule the next scan. With
+ * TOUCH_STANDBY an idle governor parks scanning instead, once
+ * calibration, saving and any sensor sample are done.
  */
-ISR(PORTA_PORT_vect)
+static void touch_scan_done(uint16_t reading)
 {
-    /* Clear the interrupt flag */
-    PORTA.INTFLAGS = MOTION_PIN;
+#if TOUCH_COMPENSATE
+    reading = touch_compensate(reading);
+#endif
+
+    if (touch_calib_left && touch_calibrate(reading))
+    {
+        touch_burst_left = TOUCH_BURST_HOLD;
+    }
+    else
+    {
+        touch_update(reading);
+    }
+
+    uint16_t baseline = touch_baseline;
+    uint16_t drift = (baseline > touch_saved) ? baseline - touch_saved : touch_saved - baseline;
+    uint8_t save = drift >= TOUCH_SAVE_DELTA;
+
+#if TOUCH_COMPENSATE
+    int16_t kt_moved = touch_comp_kt - touch_saved_kt;
+    int16_t kv_moved = touch_comp_kv - touch_saved_kv;
+
+    save |= kt_moved >= TOUCH_SAVE_K_DELTA || kt_moved <= -TOUCH_SAVE_K_DELTA ||
+            kv_moved >= TOUCH_SAVE_K_DELTA || kv_moved <= -TOUCH_SAVE_K_DELTA;
+#endif
 
-    /* Motion detected: turn on motion-enabled LED strips and reset timer */
-    shift_reg_state |= motion_enabled_strips;
-    shift_out(shift_reg_state);
-    led_timer = TIMEOUT_SEC;
+    if (!touch_calib_left && !touch_state && !touch_save_left && save)
+    {
+        touch_saved = baseline;
+#if TOUCH_COMPENSATE
+        touch_saved_kt = touch_comp_kt;
+        touch_saved_kv = touch_comp_kv;
+#endif
+        touch_save_left = TOUCH_RECORD_SIZE;
+    }
+
+    touch_save_step();
+
+#if TOUCH_STANDBY
+    if (!touch_burst_left && !touch_calib_left && !touch_save_left &&
+        touch_phase < TOUCH_SENSOR_SETTLE)
+    {
+        touch_park();
+        return;
+    }
+#endif
+
+    timer_start(TIMER_TOUCH, touch_burst_left ? TOUCH_GAP_TICKS : TOUCH_SLOW_GAP_TICKS);
 }
+#endif
 
 /*
- * TCA0 overflow ISR — ticks at 1 Hz, manages timer countdown.
- * CLK_PER = 3.333 MHz, TCA prescaler /1024 -> 3255 Hz tick rate.
- * PER = 3254 -> overflow at ~1.0 Hz.
- *
- * If PA2 is still active (held low), resets the timer.
- * Otherwise decrements, turning off motion-enabled LEDs when it reaches 0.
+ * Motion sensor edge.
+ * Start (PA2 low): turns on motion-enabled LED strips; they stay on with
+ * no timer running for as long as the sensor holds the line low.
+ * Stop (PA2 high): starts each strip's off-delay. A pulse
+ * shorter than the wake-up latency only shows up as a stop, so it also
+ * turns them on.
  */
-ISR(TCA0_OVF_vect)
+static void motion_edge(uint8_t detected)
 {
-    /* Clear the interrupt flag */
-    TCA0.SINGLE.INTFLAGS = TCA_SINGLE_OVF_bm;
-
-    if (!(PORTA.IN & MOTION_PIN))
+    if (detected)
     {
-        /* Motion sensor still active — keep motion-enabled LEDs on */
-        led_timer = TIMEOUT_SEC;
+        timeout_cancel(motion_enabled_strips);
+        motion_active = 1;
+        strip_on(motion_enabled_strips);
     }
-    else if (led_timer > 0)
+    else
     {
-        led_timer--;
-
-        /* Turn off motion-enabled LEDs when timer expires */
-        if (led_timer == 0)
+        if (!motion_active)
         {
-            shift_reg_state &= ~motion_enabled_strips;
-            shift_out(shift_reg_state);
+            strip_on(motion_enabled_strips);
         }
+
+        motion_active = 0;
+        timeout_arm(motion_enabled_strips);
     }
 }
 
 /*
- * TCB0 capture ISR — fires at ~40 Hz for capacitive touch scanning.
- * Reads filtered ADC value, compares against adaptive baseline,
- * debounces state changes, and toggles all LEDs on touch/release.
+ * Run every timer whose deadline has passed. Nothing may be due (an
+ * intermediate wake on a long wait); that just falls through.
  */
-ISR(TCB0_INT_vect)
+static void timer_run(void)
 {
-    /* Clear the interrupt flag */
-    TCB0.INTFLAGS = TCB_CAPT_bm;
-
-    uint16_t reading = touch_measure_filtered();
-    uint16_t baseline = touch_baseline;
-
-    /* Touch INCREASES reading (finger holds charge longer on this pad) */
-    uint8_t tentative = (reading > baseline) && ((reading - baseline) >= TOUCH_THRESHOLD);
+    uint32_t now = timer_now();
 
-    if (tentative != touch_state)
+    for (uint8_t id = 0; id < TIMER_COUNT; id++)
     {
-        touch_debounce_cnt++;
+        uint8_t bit = 1 << id;
 
-        if (touch_debounce_cnt >= TOUCH_DEBOUNCE)
+        if ((timer_armed & bit) && (int32_t)(timer_deadline[id] - now) <= 0)
         {
-            touch_state = tentative;
-            touch_debounce_cnt = 0;
+            timer_armed &= ~bit;
 
-            if (touch_state)
-            {
-                strip_on(ALL_LEDS);
-            }
-            else
+            switch (id)
             {
-                strip_off(ALL_LEDS);
+#if TOUCH_SENSING
+            case TIMER_TOUCH:
+                touch_scan_start();
+                break;
+#endif
+            default:
+                timeout_expire(id - TIMER_OFF);
+                break;
             }
         }
     }
-    else
+}
+
+/*
+ * Main-loop dispatcher: take the pending events and their slots in one
+ * go, then handle them with interrupts enabled, so ISRs stay short and
+ * keep their timing while the application logic runs. Events are taken
+ * in a fixed order rather than arrival order; each handler only looks at
+ * the state it is left with, so the result is the same. Strip changes
+ * from every event collapse into the commit that follows.
+ */
+static void event_dispatch(void)
+{
+    uint8_t events;
+    uint8_t level;
+#if TOUCH_SENSING
+    uint16_t reading;
+#endif
+#if TOUCH_COMPENSATE
+    uint16_t vdd_raw;
+    uint16_t temp_raw;
+#endif
+
+    ATOMIC_BLOCK(ATOMIC_FORCEON)
     {
-        touch_debounce_cnt = 0;
+        events = event_pending;
+        level = motion_level;
+#if TOUCH_SENSING
+        reading = touch_reading;
+#endif
+#if TOUCH_COMPENSATE
+        vdd_raw = touch_vdd_raw;
+        temp_raw = touch_temp_raw;
+#endif
+        event_pending = 0;
     }
 
-    /* Adaptive baseline: slowly track readings when not touched */
-    if (!touch_state)
+    if (events & EVENT_MOTION)
     {
-        if (reading > baseline)
+        motion_edge(level);
+    }
+
+    if (events & EVENT_TIMER)
+    {
+        timer_run();
+    }
+
+#if TOUCH_STANDBY
+    if (events & EVENT_TOUCH_WAKE)
+    {
+        uint16_t touched = touch_baseline + touch_threshold;
+
+        touch_burst_left = TOUCH_BURST_HOLD;
+#if TOUCH_COMPENSATE
+        touch_comp_left = 0;  /* Conditions may have moved while parked */
+        touched += touch_comp;
+#endif
+
+        /* A wake at touch level is the first debounce reading, so the
+         * fast scans confirm it in TOUCH_DEBOUNCE - 1 more */
+        if (!touch_state && !touch_calib_left && reading >= touched)
         {
-            touch_baseline += (reading - baseline) >> BASELINE_SHIFT;
+            touch_debounce_cnt = 1;
         }
-        else if (reading < baseline)
+
+        /* A scan the timers started first reschedules itself */
+        if (touch_phase == TOUCH_GAP)
+        {
+            timer_start(TIMER_TOUCH, TOUCH_GAP_TICKS);
+        }
+    }
+#endif
+
+#if TOUCH_COMPENSATE
+    if (events & EVENT_TOUCH_SENSORS)
+    {
+        touch_comp_update(vdd_raw, temp_raw);
+    }
+#endif
+
+#if TOUCH_SENSING
+    if (events & EVENT_TOUCH_SCAN)
+    {
+        touch_scan_done(reading);
+    }
+#endif
+
+#if OE_PWM
+    /* An output_commit() since the ISR may have cancelled it */
+    if ((events & EVENT_FADE_DONE) && fade_off_strips)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
         {
-            touch_baseline -= (baseline - reading) >> BASELINE_SHIFT;
+            shift_reg_state &= ~fade_off_strips;
+            fade_off_strips = 0;
+            output_update();
         }
     }
+#endif
+}
+
+/*
+ * Sleep-depth governor: the deepest mode every active subsystem survives.
+ * - Idle while something needs CLK_PER: an SPI frame in flight, BCM slots,
+ *   OE PWM on lit strips or a fade, or TCB0 timing a pad charge or the
+ *   sensor reference's start-up.
+ * - Standby while a scheduler deadline is armed on the RTC counter or a
+ *   touch conversion is running (ADC0 RUNSTBY).
+ * - Power-down otherwise. PA2 is fully asynchronous, so motion still
+ *   wakes the CPU. Touch builds never get here: TIMER_TOUCH stays armed
+ *   for the next scan, parked or not, so they top out at standby.
+ * Call after timer_program(), which decides whether a deadline is armed.
+ */
+static uint8_t sleep_depth(void)
+{
+    if (spi_busy)
+    {
+        return SLEEP_DEPTH_IDLE;
+    }
+
+#if STRIP_BRIGHTNESS
+    if (bcm_running)
+    {
+        return SLEEP_DEPTH_IDLE;
+    }
+#endif
+
+#if OE_PWM
+    if (shift_reg_state || (TCA0.SINGLE.INTCTRL & TCA_SINGLE_OVF_bm))
+    {
+        return SLEEP_DEPTH_IDLE;
+    }
+#endif
+
+#if TOUCH_SENSING
+    if (touch_phase == TOUCH_CHARGING || touch_phase == TOUCH_SENSOR_SETTLE)
+    {
+        return SLEEP_DEPTH_IDLE;
+    }
+
+    if (ADC0.COMMAND & ADC_STCONV_bm)
+    {
+        return SLEEP_DEPTH_STANDBY;
+    }
+#endif
+
+    if (RTC.INTCTRL & RTC_CMP_bm)
+    {
+        return SLEEP_DEPTH_STANDBY;
+    }
+
+    return SLEEP_DEPTH_PWR_DOWN;
+}
+
+#if SLEEP_STATS
+/*
+ * Count one sleep and its length in RTC ticks (wake-up ISRs included).
+ */
+static void sleep_record(uint8_t depth, uint16_t start)
+{
+    stats.sleep_entries[depth]++;
+    stats.sleep_ticks[depth] += (uint16_t)(RTC.CNT - start);
 }
+#endif
 
 int main(void)
 {
+#if BOOT_BENCHMARK
+    TCB0.CCMP = 0xFFFF;
+    TCB0.CNT = 0;
+    TCB0.CTRLA = TCB_CLKSEL_CLKDIV1_gc | TCB_ENABLE_bm;
+#endif
+
     /* Configure PA6 as output (latch pin for 74HC595) */
     PORTA.DIRSET = LATCH_PIN;
     PORTA.OUTCLR = LATCH_PIN; /* Start low */
 
-    /* Configure PA2 as input with pull-up, falling-edge interrupt */
+    /* Configure the motion pin (PA2, or PA7 with OUTPUT_VERIFY) as input
+     * with pull-up, interrupt on both edges (falling = motion, rising =
+     * start the timeout) */
     PORTA.DIRCLR = MOTION_PIN;
-    PORTA.PIN2CTRL = PORT_PULLUPEN_bm | PORT_ISC_FALLING_gc;
+#if MOTION_CCL
+    MOTION_PINCTRL = PORT_PULLUPEN_bm | PORT_ISC_RISING_gc;
+#else
+    MOTION_PINCTRL = PORT_PULLUPEN_bm | PORT_ISC_BOTHEDGES_gc;
+#endif
 
     /* Clear any pending interrupt flag from pin configuration */
     PORTA.INTFLAGS = MOTION_PIN;
 
+    /* Motion is the one level 1 interrupt: it preempts touch scanning */
+    CPUINT.LVL1VEC = PORTA_PORT_vect_num;
+
     /* Initialize SPI for shift register communication */
     spi_init();
 
+#if MOTION_CCL
+    /* Hand RCLK to the LUT before the first frame is latched */
+    motion_ccl_init();
+#endif
+
+#if OUTPUT_VERIFY
+    /* Choose the fastest SPI clock that reads back intact */
+    spi_autotune();
+#endif
+
     /* Start with all LEDs off */
     shift_reg_state = 0;
-    shift_out(shift_reg_state);
+    output_dirty = OUTPUT_FORCE;
+    output_commit();
+
+    /* Same off-delay for every strip, which can't fail as no strip is
+     * left in another class; override per strip here, e.g.
+     * strip_timeout_set(LED_STRIP_2, 60000) for a 60 s fireplace, up to
+     * TIMEOUT_CLASSES distinct delays (0 back means no class was free) */
+    strip_timeout_set(ALL_LEDS, TIMEOUT_MS);
+
+#if ISR_PROFILE
+    /* Free-running TCA0 timestamps for the ISR profiler */
+    profile_init();
+#endif
+
+#if OE_PWM
+    /* Hardware global dimming on the 595 OE line */
+    oe_pwm_init();
+#endif
+
+    /* Motion and SPI are live from here */
+    sei();
 
-    /* Configure TCA0 in Normal mode:
-     * - Prescaler /1024
-     * - Period for ~1 second overflow at 3.333 MHz / 1024 = 3255 Hz
-     */
-    TCA0.SINGLE.PER = 3254;
-    TCA0.SINGLE.CTRLA = TCA_SINGLE_CLKSEL_DIV1024_gc | TCA_SINGLE_ENABLE_bm;
+#if BOOT_BENCHMARK
+    boot_motion_cycles = TCB0.CNT;
+#endif
 
-    /* Enable overflow interrupt */
-    TCA0.SINGLE.INTCTRL = TCA_SINGLE_OVF_bm;
+    /* Start the RTC counter for scheduler deadlines (waits ~2 RTC clocks
+     * to sync, so after motion is live) */
+    rtc_init();
 
+#if SHIFT_BENCHMARK
+    shift_benchmark();
+#endif
+
+#if TOUCH_SENSING
     /* Initialize ADC for capacitive touch sensing */
     adc_init();
 
-    /* Calibrate touch baseline (don't touch pad during power-up!) */
-    uint32_t baseline_sum = 0;
-    for (uint8_t i = 0; i < BASELINE_INIT_CYCLES; i++)
-    {
-        baseline_sum += touch_measure_filtered();
-    }
-    touch_baseline = (uint16_t)(baseline_sum / BASELINE_INIT_CYCLES);
+    /* Stored baseline now, calibration in the background scans (without
+     * a stored one, don't touch the pad for the first ~0.4 s) */
+    touch_baseline_restore();
 
     /* Start capacitive touch scanning at ~40 Hz */
-    tcb0_init();
+    touch_scan_init();
+
+#if TOUCH_COMPENSATE
+    /* Sample the sensors before the first scan, so a restored baseline
+     * meets the correction for the conditions at power-up */
+    touch_comp_left = TOUCH_COMP_SCANS;
+    touch_sensor_start();
+#endif
+#endif
+
+#if BOOT_BENCHMARK
+    boot_loop_cycles = TCB0.CNT;
+    TCB0.CTRLA = 0;
+#endif
+
+    /* Dispatch, commit, then sleep as deep as sleep_depth() allows.
+     * Wakes on PA2 edges, RTC deadline, TCB0 charge, ADC result or window,
+     * SPI complete or BCM slot. */
+    while (1)
+    {
+        event_dispatch();
 
-    /* Enable global interrupts */
-    sei();
+        /* Commit point: push the strip changes the dispatcher made, then
+         * sleep. An event posted since the dispatch goes round again
+         * first; sei() holds off interrupts for one instruction, so one
+         * posted after this check still wakes sleep. */
+        cli();
 
-    /* Idle sleep — CPU halts, peripherals and interrupts stay active.
-     * Wakes on PA2 pin-change or TCA0 overflow. */
-    set_sleep_mode(SLEEP_MODE_IDLE);
+        if (event_pending)
+        {
+            sei();
+            continue;
+        }
 
-    while (1)
-    {
-        sleep_mode();
+        output_commit();
+        timer_program();
+
+        uint8_t depth = sleep_depth();
+        set_sleep_mode(sleep_modes[depth]);
+        sleep_enable();
+#if SLEEP_STATS
+        uint16_t sleep_start = RTC.CNT;
+#endif
+        sei();
+        sleep_cpu();
+        sleep_disable();
+
+#if SLEEP_STATS
+        sleep_record(depth, sleep_start);
+#endif
     }
 }
@@ -0,0 +1,22 @@
+/*
+ * eeprom.h (host simulation build)
+ *
+ * EEMEM variables are collected in their own section, which is the
+ * EEPROM image: sim.c loads it before boot and saves it after a run, so
+ * one scenario can reboot into what another one stored. A byte write
+ * keeps the EEPROM busy for the datasheet's 4 ms.
+ */
+
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EEMEM  __attribute__((section("sim_eeprom")))
+
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_update_byte(uint8_t *addr, uint8_t value);
+int eeprom_is_ready(void);
+
+#endif /* SIM_AVR_EEPROM_H */
@@ -0,0 +1,19 @@
+/*
+ * interrupt.h (host simulation build)
+ *
+ * ISRs become plain functions that sim.c calls when their flag and enable
+ * are set. sei() takes effect one instruction later, as on the part: a
+ * pending interrupt is taken at the next register access or sleep.
+ */
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define ISR(vector)  void vector(void); void vector(void)
+
+#define sei()  (sim_sreg |= CPU_I_bm)
+#define cli()  (sim_sreg &= (uint8_t)~CPU_I_bm)
+
+#endif /* SIM_AVR_INTERRUPT_H */
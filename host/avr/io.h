@@ -0,0 +1,357 @@
+/*
+ * io.h (host simulation build)
+ *
+ * Mock of the ATtiny412 register file, covering what main.c uses. Every
+ * peripheral access goes through sim_io(), which applies the previous
+ * write's side effects, advances virtual time by one CPU cycle and may
+ * take a pending interrupt, so busy-waits and ISR preemption behave as
+ * on the part. Registers whose writes have side effects (strobes, the
+ * write-one-to-clear flags, buffered timer registers) are wider here:
+ * the models park bit 8 (bit 16) in them, and a firmware write shows up
+ * as that bit clearing. Bit values follow the ATtiny412 datasheet.
+ */
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+
+typedef volatile uint8_t register8_t;
+typedef volatile uint16_t register16_t;
+typedef volatile uint16_t strobe8_t;     /* 8-bit register, writes detected */
+typedef volatile uint32_t strobe16_t;    /* 16-bit register, writes detected */
+
+#define SIM_STROBE8   0x100
+#define SIM_STROBE16  0x10000UL
+
+/* Pins */
+#define PIN0_bm  0x01
+#define PIN1_bm  0x02
+#define PIN2_bm  0x04
+#define PIN3_bm  0x08
+#define PIN4_bm  0x10
+#define PIN5_bm  0x20
+#define PIN6_bm  0x40
+#define PIN7_bm  0x80
+
+/* PORT */
+typedef struct
+{
+    register8_t DIR;
+    strobe8_t DIRSET;
+    strobe8_t DIRCLR;
+    strobe8_t DIRTGL;
+    register8_t OUT;
+    strobe8_t OUTSET;
+    strobe8_t OUTCLR;
+    strobe8_t OUTTGL;
+    register8_t IN;
+    strobe8_t INTFLAGS;
+    register8_t PORTCTRL;
+    register8_t PIN0CTRL;
+    register8_t PIN1CTRL;
+    register8_t PIN2CTRL;
+    register8_t PIN3CTRL;
+    register8_t PIN4CTRL;
+    register8_t PIN5CTRL;
+    register8_t PIN6CTRL;
+    register8_t PIN7CTRL;
+} PORT_t;
+
+typedef struct
+{
+    register8_t DIR;
+    register8_t OUT;
+    register8_t IN;
+    register8_t INTFLAGS;
+} VPORT_t;
+
+#define PORT_ISC_gm                0x07
+#define PORT_ISC_INTDISABLE_gc     0x00
+#define PORT_ISC_BOTHEDGES_gc      0x01
+#define PORT_ISC_RISING_gc         0x02
+#define PORT_ISC_FALLING_gc        0x03
+#define PORT_ISC_INPUT_DISABLE_gc  0x04
+#define PORT_ISC_LEVEL_gc          0x05
+#define PORT_PULLUPEN_bm           0x08
+#define PORT_INVEN_bm              0x80
+
+/* SPI */
+typedef struct
+{
+    register8_t CTRLA;
+    register8_t CTRLB;
+    register8_t INTCTRL;
+    strobe8_t INTFLAGS;
+    strobe8_t DATA;
+} SPI_t;
+
+#define SPI_DORD_bm         0x40
+#define SPI_MASTER_bm       0x20
+#define SPI_CLK2X_bm        0x10
+#define SPI_PRESC_gm        0x06
+#define SPI_PRESC_DIV4_gc   0x00
+#define SPI_PRESC_DIV16_gc  0x02
+#define SPI_PRESC_DIV64_gc  0x04
+#define SPI_PRESC_DIV128_gc 0x06
+#define SPI_ENABLE_bm       0x01
+#define SPI_BUFEN_bm        0x80
+#define SPI_BUFWR_bm        0x40
+#define SPI_SSD_bm          0x04
+#define SPI_MODE_0_gc       0x00
+#define SPI_RXCIE_bm        0x80
+#define SPI_TXCIE_bm        0x40
+#define SPI_DREIE_bm        0x20
+#define SPI_RXCIF_bm        0x80
+#define SPI_TXCIF_bm        0x40
+#define SPI_DREIF_bm        0x20
+
+/* TCA0 (single-slope mode only) */
+typedef struct
+{
+    register8_t CTRLA;
+    register8_t CTRLB;
+    register8_t CTRLC;
+    register8_t CTRLD;
+    register8_t INTCTRL;
+    strobe8_t INTFLAGS;
+    register16_t CNT;
+    register16_t PER;
+    register16_t CMP0;
+    strobe16_t PERBUF;
+    strobe16_t CMP0BUF;
+} TCA_SINGLE_t;
+
+typedef union
+{
+    TCA_SINGLE_t SINGLE;
+} TCA_t;
+
+#define TCA_SINGLE_CLKSEL_gm            0x0E
+#define TCA_SINGLE_CLKSEL_DIV1_gc       0x00
+#define TCA_SINGLE_CLKSEL_DIV2_gc       0x02
+#define TCA_SINGLE_CLKSEL_DIV4_gc       0x04
+#define TCA_SINGLE_CLKSEL_DIV8_gc       0x06
+#define TCA_SINGLE_CLKSEL_DIV16_gc      0x08
+#define TCA_SINGLE_CLKSEL_DIV64_gc      0x0A
+#define TCA_SINGLE_CLKSEL_DIV256_gc     0x0C
+#define TCA_SINGLE_CLKSEL_DIV1024_gc    0x0E
+#define TCA_SINGLE_ENABLE_bm            0x01
+#define TCA_SINGLE_CMP0EN_bm            0x10
+#define TCA_SINGLE_WGMODE_SINGLESLOPE_gc 0x03
+#define TCA_SINGLE_OVF_bm               0x01
+
+/* TCB0 (periodic interrupt mode only) */
+typedef struct
+{
+    register8_t CTRLA;
+    register8_t CTRLB;
+    register8_t INTCTRL;
+    strobe8_t INTFLAGS;
+    register16_t CNT;
+    register16_t CCMP;
+} TCB_t;
+
+#define TCB_CLKSEL_gm            0x06
+#define TCB_CLKSEL_CLKDIV1_gc    0x00
+#define TCB_CLKSEL_CLKDIV2_gc    0x02
+#define TCB_ENABLE_bm            0x01
+#define TCB_CAPT_bm              0x01
+
+/* ADC0 */
+typedef struct
+{
+    register8_t CTRLA;
+    register8_t CTRLB;
+    register8_t CTRLC;
+    register8_t CTRLD;
+    register8_t CTRLE;
+    register8_t SAMPCTRL;
+    register8_t MUXPOS;
+    register8_t COMMAND;
+    register8_t INTCTRL;
+    strobe8_t INTFLAGS;
+    register16_t RES;
+    register16_t WINLT;
+    register16_t WINHT;
+} ADC_t;
+
+#define ADC_RUNSTBY_bm           0x80
+#define ADC_RESSEL_bm            0x04
+#define ADC_ENABLE_bm            0x01
+#define ADC_SAMPNUM_gm           0x07
+#define ADC_SAMPNUM_ACC1_gc      0x00
+#define ADC_SAMPNUM_ACC2_gc      0x01
+#define ADC_SAMPNUM_ACC4_gc      0x02
+#define ADC_SAMPNUM_ACC8_gc      0x03
+#define ADC_SAMPNUM_ACC16_gc     0x04
+#define ADC_SAMPNUM_ACC32_gc     0x05
+#define ADC_SAMPNUM_ACC64_gc     0x06
+#define ADC_SAMPCAP_bm           0x40
+#define ADC_REFSEL_gm            0x30
+#define ADC_REFSEL_INTREF_gc     0x00
+#define ADC_REFSEL_VDDREF_gc     0x10
+#define ADC_PRESC_gm             0x07
+#define ADC_WINCM_gm             0x07
+#define ADC_WINCM_NONE_gc        0x00
+#define ADC_WINCM_BELOW_gc       0x01
+#define ADC_WINCM_ABOVE_gc       0x02
+#define ADC_WINCM_INSIDE_gc      0x03
+#define ADC_WINCM_OUTSIDE_gc     0x04
+#define ADC_MUXPOS_AIN7_gc       0x07
+#define ADC_MUXPOS_INTREF_gc     0x1D
+#define ADC_MUXPOS_TEMPSENSE_gc  0x1E
+#define ADC_MUXPOS_GND_gc        0x1F
+#define ADC_STCONV_bm            0x01
+#define ADC_WCMP_bm              0x02
+#define ADC_RESRDY_bm            0x01
+
+/* RTC */
+typedef struct
+{
+    register8_t CTRLA;
+    register8_t STATUS;
+    register8_t INTCTRL;
+    strobe8_t INTFLAGS;
+    register8_t CLKSEL;
+    register16_t CNT;
+    register16_t PER;
+    register16_t CMP;
+} RTC_t;
+
+#define RTC_RUNSTDBY_bm          0x80
+#define RTC_PRESCALER_gm         0x78
+#define RTC_PRESCALER_gp         3
+#define RTC_RTCEN_bm             0x01
+#define RTC_CMPBUSY_bm           0x08
+#define RTC_PERBUSY_bm           0x04
+#define RTC_CNTBUSY_bm           0x02
+#define RTC_CTRLABUSY_bm         0x01
+#define RTC_CMP_bm               0x02
+#define RTC_OVF_bm               0x01
+#define RTC_CLKSEL_INT32K_gc     0x00
+
+/* VREF */
+typedef struct
+{
+    register8_t CTRLA;
+    register8_t CTRLB;
+} VREF_t;
+
+#define VREF_ADC0REFSEL_gm       0x70
+#define VREF_ADC0REFSEL_0V55_gc  0x00
+#define VREF_ADC0REFSEL_1V1_gc   0x10
+#define VREF_ADC0REFSEL_2V5_gc   0x20
+#define VREF_ADC0REFSEL_4V34_gc  0x30
+#define VREF_ADC0REFSEL_1V5_gc   0x40
+#define VREF_ADC0REFEN_bm        0x02
+
+/* Signature row */
+typedef struct
+{
+    register8_t TEMPSENSE0;
+    register8_t TEMPSENSE1;
+} SIGROW_t;
+
+/* Event system */
+typedef struct
+{
+    strobe8_t ASYNCSTROBE;
+    register8_t ASYNCCH1;
+    register8_t ASYNCUSER2;
+} EVSYS_t;
+
+#define EVSYS_ASYNCSTROBE_ASYNCCH1_bm  0x02
+#define EVSYS_ASYNCCH1_OFF_gc          0x00
+#define EVSYS_ASYNCUSER_ASYNCCH1_gc    0x04
+
+/* CCL (LUT0 only) */
+typedef struct
+{
+    register8_t CTRLA;
+    register8_t LUT0CTRLA;
+    register8_t LUT0CTRLB;
+    register8_t LUT0CTRLC;
+    register8_t TRUTH0;
+} CCL_t;
+
+#define CCL_RUNSTDBY_bm          0x40
+#define CCL_ENABLE_bm            0x01
+#define CCL_OUTEN_bm             0x08
+#define CCL_INSEL0_gm            0x0F
+#define CCL_INSEL0_MASK_gc       0x00
+#define CCL_INSEL0_EVENT0_gc     0x03
+#define CCL_INSEL1_gm            0xF0
+#define CCL_INSEL1_MASK_gc       0x00
+#define CCL_INSEL2_gm            0x0F
+#define CCL_INSEL2_IO_gc         0x05
+
+/* CPUINT, PORTMUX, fuses */
+typedef struct
+{
+    register8_t CTRLA;
+    register8_t STATUS;
+    register8_t LVL0PRI;
+    register8_t LVL1VEC;
+} CPUINT_t;
+
+typedef struct
+{
+    register8_t CTRLC;
+} PORTMUX_t;
+
+#define PORTMUX_TCA00_bm         0x01
+
+typedef struct
+{
+    register8_t SYSCFG1;
+} FUSE_t;
+
+/* Vector numbers */
+#define PORTA_PORT_vect_num      3
+#define RTC_CNT_vect_num         6
+#define TCA0_OVF_vect_num        8
+#define TCB0_INT_vect_num        13
+#define ADC0_RESRDY_vect_num     17
+#define ADC0_WCOMP_vect_num      18
+#define SPI0_INT_vect_num        21
+
+/* Register instances live in sim.c; firmware reaches them through the
+ * access hook, the models directly */
+extern PORT_t sim_porta;
+extern VPORT_t sim_vporta;
+extern SPI_t sim_spi0;
+extern TCA_t sim_tca0;
+extern TCB_t sim_tcb0;
+extern ADC_t sim_adc0;
+extern RTC_t sim_rtc;
+extern VREF_t sim_vref;
+extern SIGROW_t sim_sigrow;
+extern EVSYS_t sim_evsys;
+extern CCL_t sim_ccl;
+extern CPUINT_t sim_cpuint;
+extern PORTMUX_t sim_portmux;
+extern FUSE_t sim_fuse;
+extern volatile uint8_t sim_sreg;
+
+void *sim_io(volatile void *reg);
+
+#define PORTA    (*(PORT_t *)sim_io(&sim_porta))
+#define VPORTA   (*(VPORT_t *)sim_io(&sim_vporta))
+#define SPI0     (*(SPI_t *)sim_io(&sim_spi0))
+#define TCA0     (*(TCA_t *)sim_io(&sim_tca0))
+#define TCB0     (*(TCB_t *)sim_io(&sim_tcb0))
+#define ADC0     (*(ADC_t *)sim_io(&sim_adc0))
+#define RTC      (*(RTC_t *)sim_io(&sim_rtc))
+#define VREF     (*(VREF_t *)sim_io(&sim_vref))
+#define SIGROW   (*(SIGROW_t *)sim_io(&sim_sigrow))
+#define EVSYS    (*(EVSYS_t *)sim_io(&sim_evsys))
+#define CCL      (*(CCL_t *)sim_io(&sim_ccl))
+#define CPUINT   (*(CPUINT_t *)sim_io(&sim_cpuint))
+#define PORTMUX  (*(PORTMUX_t *)sim_io(&sim_portmux))
+#define FUSE     (*(FUSE_t *)sim_io(&sim_fuse))
+#define SREG     sim_sreg
+
+#define CPU_I_bm  0x80
+
+#endif /* SIM_AVR_IO_H */
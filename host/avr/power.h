@@ -0,0 +1,8 @@
+/*
+ * power.h (host simulation build): nothing main.c uses.
+ */
+
+#ifndef SIM_AVR_POWER_H
+#define SIM_AVR_POWER_H
+
+#endif /* SIM_AVR_POWER_H */
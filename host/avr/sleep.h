@@ -0,0 +1,23 @@
+/*
+ * sleep.h (host simulation build)
+ *
+ * sleep_cpu() hands control to the scheduler in sim.c, which runs virtual
+ * time forward to the next interrupt the chosen mode can wake from.
+ */
+
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE      0x00
+#define SLEEP_MODE_STANDBY   0x02
+#define SLEEP_MODE_PWR_DOWN  0x04
+
+extern unsigned char sim_sleep_mode;
+void sim_sleep(void);
+
+#define set_sleep_mode(mode)  (sim_sleep_mode = (mode))
+#define sleep_enable()        ((void)0)
+#define sleep_disable()       ((void)0)
+#define sleep_cpu()           sim_sleep()
+
+#endif /* SIM_AVR_SLEEP_H */
@@ -0,0 +1,1349 @@
+/*
+ * scenarios.c
+ *
+ * main.c built against the mock headers, and the scenarios that drive it.
+ * The firmware is included rather than linked, so scenarios can read its
+ * state and call its strip API between runs (only while it sleeps).
+ * Each scenario checks what the 595 outputs show and when, against the
+ * virtual clock.
+ */
+
+#define main firmware_main
+#include "../HP Book Nook/main.c"
+#undef main
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim.h"
+
+const uint8_t sim_chain_length = CHAIN_LENGTH;
+
+/* Slack on a timeout: one RTC tick, the CMP lead and the wake-up */
+#define TIMEOUT_SLACK_MS   (3 + 3000 / RTC_TICKS_PER_SEC)
+/* A timeout counts whole ticks from the tick the release falls in */
+#define TICK_MS            (1000.0 / RTC_TICKS_PER_SEC)
+#if OE_PWM
+#define FADE_MS            700     /* Fade-out before the strips clear */
+#else
+#define FADE_MS            0
+#endif
+
+#define LONG_RUN_SEC       20000
+
+static double wall_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void report_power(uint64_t since, const sim_stats_t *before)
+{
+    double span = (double)(sim_now - since);
+    uint32_t sleeps = 0;
+
+    for (unsigned i = 0; i < 3; i++)
+    {
+        sleeps += sim_stats.sleeps[i] - before->sleeps[i];
+    }
+
+    sim_report("awake %.3f%%, idle %.2f%%, standby %.2f%%, power-down %.2f%%, %.1f wakes/s",
+               100.0 * (sim_stats.awake - before->awake) / span,
+               100.0 * (sim_stats.asleep[0] - before->asleep[0]) / span,
+               100.0 * (sim_stats.asleep[1] - before->asleep[1]) / span,
+               100.0 * (sim_stats.asleep[2] - before->asleep[2]) / span,
+               sleeps / (span / F_CPU));
+}
+
+/*
+ * Boot and let the background touch calibration finish.
+ */
+static void boot_settled(void)
+{
+    sim_boot();
+    sim_run_until(SIM_SEC(2));
+    SIM_EXPECT(sim_outputs() == 0, "outputs %llx after boot", (unsigned long long)sim_outputs());
+}
+
+/*
+ * Check the outputs drop to remaining one timeout after a release, in one
+ * latch; returns when they did.
+ */
+static uint64_t expect_off_after(uint64_t remaining, uint32_t timeout_ms, uint64_t release)
+{
+    uint64_t off = sim_wait_outputs(remaining, release + SIM_MS(timeout_ms + FADE_MS + 50));
+
+    SIM_EXPECT(off != SIM_NEVER, "outputs %llx, expected %llx %u ms after release",
+               (unsigned long long)sim_outputs(), (unsigned long long)remaining, timeout_ms);
+
+    double ms = SIM_TO_MS(off - release);
+
+    SIM_EXPECT(ms >= timeout_ms - TICK_MS && ms <= timeout_ms + FADE_MS + TIMEOUT_SLACK_MS,
+               "went to %llx %.3f ms after release, timeout %u ms",
+               (unsigned long long)remaining, ms, timeout_ms);
+
+    return off;
+}
+
+/*
+ * Power-up shows an all-off frame, then nothing is shifted while idle.
+ * Without touch nothing is armed, so the CPU sits in power-down.
+ */
+static void scenario_boot_dark(void)
+{
+    sim_stats_t before;
+
+    sim_boot();
+    sim_run_until(SIM_MS(5));
+    SIM_EXPECT(sim_latches() == 1 && sim_outputs() == 0, "%u latches, outputs %llx",
+               sim_latches(), (unsigned long long)sim_outputs());
+
+    sim_run_until(SIM_SEC(10));
+    before = sim_stats;
+    sim_run_until(SIM_SEC(70));
+    SIM_EXPECT(sim_latches() == 1, "%u latches while idle", sim_latches());
+#if !TOUCH_SENSING
+    SIM_EXPECT(sim_stats.asleep[2] - before.asleep[2] > SIM_SEC(59),
+               "%.1f s of 60 idle in power-down",
+               SIM_TO_MS(sim_stats.asleep[2] - before.asleep[2]) / 1000);
+#endif
+    report_power(SIM_SEC(10), &before);
+}
+
+/*
+ * Motion lights every strip at once, they stay lit while the sensor
+ * holds, and go dark exactly one timeout after it releases.
+ */
+static void scenario_motion_timeout(void)
+{
+    boot_settled();
+
+    uint64_t start = sim_now;
+    uint32_t changes = sim_latches();
+
+    sim_motion(1);
+
+    uint64_t on = sim_wait_outputs(ALL_LEDS, start + SIM_MS(5));
+
+    SIM_EXPECT(on != SIM_NEVER, "not lit 5 ms after motion");
+    sim_report("motion to light %.1f us", SIM_TO_US(on - start));
+
+    sim_run_until(start + SIM_SEC(3));
+    SIM_EXPECT(sim_outputs() == ALL_LEDS, "outputs %llx while motion held",
+               (unsigned long long)sim_outputs());
+
+    uint64_t release = sim_now;
+
+    sim_motion(0);
+    expect_off_after(0, TIMEOUT_MS, release);
+    sim_report("dark %.3f ms after release", SIM_TO_MS(sim_changed_at() - release));
+    SIM_EXPECT(sim_latches() - changes >= 2, "no frames latched");
+}
+
+/*
+ * Motion again inside the timeout keeps the strips lit without a flicker,
+ * and the timeout restarts from the last release.
+ */
+static void scenario_motion_retrigger(void)
+{
+    boot_settled();
+
+    sim_motion(1);
+    SIM_EXPECT(sim_wait_outputs(ALL_LEDS, sim_now + SIM_MS(5)) != SIM_NEVER, "not lit");
+
+    uint64_t lit = sim_changed_at();
+
+    sim_run(SIM_SEC(1));
+    sim_motion(0);
+    sim_run(SIM_MS(TIMEOUT_MS / 2));
+    sim_motion(1);
+    sim_run(SIM_SEC(1));
+    sim_motion(0);
+
+    uint64_t release = sim_now;
+
+    sim_run(SIM_MS(TIMEOUT_MS / 2));
+    SIM_EXPECT(sim_outputs() == ALL_LEDS && sim_changed_at() == lit,
+               "outputs changed while retriggered");
+    expect_off_after(0, TIMEOUT_MS, release);
+}
+
+/*
+ * Per-strip timeouts: a short one runs out on its own, a long one
+ * outlives the default, and strips sharing a deadline go dark together.
+ * A delay that finds every class taken is refused and the strip keeps
+ * the one it had, the default.
+ */
+static void scenario_strip_timeouts(void)
+{
+    uint32_t long_ms = TIMEOUT_MS + (MAX_TIMEOUT_MS - TIMEOUT_MS) / 2;
+    uint32_t short_ms = (TIMEOUT_MS > 600) ? 300 : TIMEOUT_MS / 2;
+
+    boot_settled();
+    SIM_EXPECT(strip_timeout_set(LED_STRIP_2, long_ms) == (TIMEOUT_CLASSES > 1),
+               "long delay: wrong status");
+    SIM_EXPECT(strip_timeout_set(LED_STRIP_3, short_ms) == (TIMEOUT_CLASSES > 2),
+               "short delay: wrong status");
+    SIM_EXPECT(strip_timeout_set(LED_STRIP_4, TIMEOUT_MS), "default delay refused");
+
+    sim_motion(1);
+    SIM_EXPECT(sim_wait_outputs(ALL_LEDS, sim_now + SIM_MS(5)) != SIM_NEVER, "not lit");
+    sim_run(SIM_MS(100));
+    sim_motion(0);
+
+    uint64_t release = sim_now;
+
+#if TIMEOUT_CLASSES > 2
+    expect_off_after(ALL_LEDS & ~LED_STRIP_3, short_ms, release);
+#endif
+#if TIMEOUT_CLASSES > 1
+    expect_off_after(LED_STRIP_2, TIMEOUT_MS, release);
+    expect_off_after(0, long_ms, release);
+#else
+    expect_off_after(0, TIMEOUT_MS, release);
+#endif
+}
+
+/*
+ * An off-delay past the 65535-tick limit is held at the limit, even one
+ * whose tick count wraps 32 bits on the AVR.
+ */
+static void scenario_timeout_clamp(void)
+{
+    boot_settled();
+    SIM_EXPECT(strip_timeout_set(LED_STRIP_2, (uint32_t)((1ULL << 32) / RTC_TICKS_PER_SEC)),
+               "clamped delay refused");
+
+    sim_motion(1);
+    SIM_EXPECT(sim_wait_outputs(ALL_LEDS, sim_now + SIM_MS(5)) != SIM_NEVER, "not lit");
+    sim_run(SIM_MS(100));
+    sim_motion(0);
+
+    uint64_t release = sim_now;
+
+    expect_off_after(LED_STRIP_2, TIMEOUT_MS, release);
+    expect_off_after(0, MAX_TIMEOUT_MS, release);
+}
+
+/*
+ * Random motion for hours of virtual time: every start lights the strips
+ * within 5 ms, and a timeout after the last release they are dark.
+ */
+static void scenario_long_run(void)
+{
+    double wall = wall_seconds();
+    uint64_t release = 0;
+    uint64_t end = SIM_SEC(LONG_RUN_SEC);
+    uint32_t starts = 0;
+
+    boot_settled();
+
+    while (sim_now < end)
+    {
+        uint64_t gap = (uint64_t)(-log(1.0 - sim_uniform()) * SIM_SEC(90));
+
+        sim_run(gap + 1);
+
+        if (release && sim_now - release > SIM_MS(TIMEOUT_MS + FADE_MS + TIMEOUT_SLACK_MS))
+        {
+            SIM_EXPECT(sim_outputs() == 0, "outputs %llx %.0f ms after release",
+                       (unsigned long long)sim_outputs(), SIM_TO_MS(sim_now - release));
+        }
+
+        uint64_t start = sim_now;
+
+        sim_motion(1);
+        SIM_EXPECT(sim_wait_outputs(ALL_LEDS, start + SIM_MS(5)) != SIM_NEVER,
+                   "not lit 5 ms after motion");
+        starts++;
+
+        /* Anything from a glitch to a long stay */
+        uint64_t hold = (sim_uniform() < 0.1) ? SIM_US(200)
+                      : (uint64_t)(sim_uniform() * SIM_SEC(20));
+
+        sim_run(hold + 1);
+        sim_motion(0);
+        release = sim_now;
+    }
+
+    wall = wall_seconds() - wall;
+    sim_report("%u motion events over %d s, %.0f virtual seconds per second",
+               starts, LONG_RUN_SEC, LONG_RUN_SEC / wall);
+}
+
+#if TOUCH_SENSING
+/* Touch to light: the first reading at touch level waits for the next
+ * idle scan (a parked charge with TOUCH_STANDBY, else a slow-rate scan of
+ * ~5 ms), then fast scans confirm it within TOUCH_CONFIRM_MS */
+#define TOUCH_CONFIRM_MS   125
+#if TOUCH_STANDBY
+#define TOUCH_IDLE_MS      (1000.0 * TOUCH_PARK_TICKS / RTC_TICKS_PER_SEC)
+#else
+#define TOUCH_IDLE_MS      (1000.0 * TOUCH_SLOW_GAP_TICKS / RTC_TICKS_PER_SEC + 5)
+#endif
+
+/*
+ * A touch lights every strip and letting go turns them off again.
+ */
+static void scenario_touch(void)
+{
+    boot_settled();
+    SIM_EXPECT(!touch_calib_left && !touch_calib_blind, "still calibrating");
+
+    uint64_t start = sim_now;
+    uint64_t counted = SIM_NEVER;
+    uint32_t wakes = sim_stats.isr[ADC0_WCOMP_vect_num];
+
+    sim_pad.touch = 60;
+
+    /* In 1 ms slices, noting the first reading at touch level: a parked
+     * charge's window wake, or a scan that debounce counts */
+    while (sim_outputs() != ALL_LEDS && sim_now < start + SIM_MS(500))
+    {
+        sim_run(SIM_MS(1));
+
+        if (counted == SIM_NEVER && (touch_debounce_cnt || touch_state ||
+                                     sim_stats.isr[ADC0_WCOMP_vect_num] != wakes))
+        {
+            counted = sim_now;
+        }
+    }
+
+    SIM_EXPECT(sim_outputs() == ALL_LEDS, "touch not seen in 500 ms");
+
+    uint64_t on = sim_changed_at();
+
+    sim_report("touch to light %.1f ms, first reading counted to light %.1f ms, threshold %u",
+               SIM_TO_MS(on - start), SIM_TO_MS(on - counted), touch_threshold);
+    SIM_EXPECT(on - counted < SIM_MS(TOUCH_CONFIRM_MS), "confirmed %.1f ms after the first reading",
+               SIM_TO_MS(on - counted));
+    SIM_EXPECT(SIM_TO_MS(on - start) < TOUCH_IDLE_MS + TOUCH_CONFIRM_MS,
+               "lit %.1f ms after the touch, idle scans %.0f ms apart",
+               SIM_TO_MS(on - start), TOUCH_IDLE_MS);
+
+    sim_run(SIM_SEC(1));
+
+    uint64_t release = sim_now;
+
+    sim_pad.touch = 0;
+
+    uint64_t off = sim_wait_outputs(0, release + SIM_MS(500));
+
+    SIM_EXPECT(off != SIM_NEVER, "release not seen in 500 ms");
+    sim_report("release to dark %.1f ms", SIM_TO_MS(off - release));
+    SIM_EXPECT(touch_events == 1, "%u touch events", touch_events);
+}
+
+/*
+ * The first boot calibrates blind and saves the baseline to EEPROM.
+ */
+static void scenario_touch_save(void)
+{
+    touch_record_t record;
+
+    boot_settled();
+    sim_run_until(SIM_SEC(3));
+    eeprom_read_block(&record, &touch_record, sizeof(record));
+    SIM_EXPECT(record.layout == TOUCH_RECORD_LAYOUT && record.check == touch_record_check(&record) &&
+               record.baseline == touch_saved, "record %u/%02x/%02x, saved %u",
+               record.baseline, record.layout, record.check, touch_saved);
+    sim_report("baseline %u saved in %u byte writes", record.baseline, sim_stats.eeprom_writes);
+}
+
+/*
+ * The next boot restores it, so a touch straight after power-up counts.
+ */
+static void scenario_touch_restore(void)
+{
+    sim_boot();
+    sim_run_until(SIM_MS(30));
+    SIM_EXPECT(!touch_calib_blind, "restored baseline not used");
+
+    sim_pad.touch = 60;
+
+    uint64_t on = sim_wait_outputs(ALL_LEDS, SIM_MS(330));
+
+    SIM_EXPECT(on != SIM_NEVER, "touch at power-up not seen in 300 ms");
+    sim_report("lit %.1f ms after power-up", SIM_TO_MS(on));
+}
+
+/*
+ * A record from before the layout byte, {baseline, XOR check} with erased
+ * bytes after it, reads back invalid: the boot calibrates blind and
+ * touches count once it has.
+ */
+static void scenario_touch_record_legacy(void)
+{
+    uint8_t *bytes = (uint8_t *)&touch_record;
+
+    memset(bytes, 0xFF, sizeof(touch_record));
+    bytes[0] = 400 & 0xFF;
+    bytes[1] = 400 >> 8;
+    bytes[2] = bytes[0] ^ bytes[1] ^ 0x5A;
+
+    sim_boot();
+    sim_run_until(SIM_MS(30));
+    SIM_EXPECT(touch_calib_blind, "legacy record restored");
+
+    sim_run_until(SIM_SEC(3));
+    sim_pad.touch = 60;
+    sim_run(SIM_MS(300));
+    sim_pad.touch = 0;
+    sim_run(SIM_MS(500));
+
+    SIM_EXPECT(touch_events == 1, "%u touch events after recalibrating", touch_events);
+    sim_report("recalibrated to baseline %u", touch_baseline);
+}
+
+/*
+ * Run with burst scanning held on, so untouched readings keep feeding the
+ * noise estimate instead of parking.
+ */
+static void touch_scan_for(uint64_t cycles)
+{
+    uint64_t end = sim_now + cycles;
+
+    while (sim_now < end)
+    {
+        touch_burst_left = TOUCH_BURST_HOLD;
+        sim_run(SIM_MS(10));
+    }
+}
+
+#if TOUCH_COMPENSATE
+/*
+ * Temperature/VDD samples run from the ISRs between scans: a supply step
+ * reaches the correction's inputs, and the CPU sleeps through every
+ * sample's conversions instead of waiting them out.
+ */
+static void scenario_touch_sensors(void)
+{
+    boot_settled();
+
+    /* A real touch unparks idle scanning; burst scanning is held from here */
+    sim_pad.touch = 60;
+    sim_run(SIM_MS(300));
+    sim_pad.touch = 0;
+
+    sim_stats.awake_max = 0;
+    touch_scan_for(SIM_SEC(2));
+    sim_vdd = 3.0;
+    touch_scan_for(SIM_SEC(2));
+
+    SIM_EXPECT(touch_vdd_delta >= -32 && touch_vdd_delta <= -28,
+               "VDD 3.3 -> 3.0 V sampled as %d x 10 mV", touch_vdd_delta);
+    SIM_EXPECT(SIM_TO_US(sim_stats.awake_max) < 500, "awake for %.0f us at a stretch",
+               SIM_TO_US(sim_stats.awake_max));
+    sim_report("VDD step sampled as %d x 10 mV, longest wake %.0f us",
+               touch_vdd_delta, SIM_TO_US(sim_stats.awake_max));
+}
+#endif
+
+/*
+ * The threshold follows the scan noise: quiet readings settle at the
+ * floor and a touch of twice it counts, noisy ones raise it enough that
+ * nothing false-triggers while a real touch still does. Noise is given
+ * per scan reading, so every sample count sees the same levels.
+ */
+static void scenario_touch_noise(void)
+{
+    static const struct { const char *name; double rms; double touch; } conditions[] = {
+        { "quiet", 0.25, 2 * TOUCH_THRESHOLD_MIN },
+        { "noisy", 4.0, 60 },
+    };
+
+    boot_settled();
+
+    /* A real touch unparks idle scanning; burst scanning is held from here */
+    sim_pad.touch = 60;
+    sim_run(SIM_MS(300));
+    sim_pad.touch = 0;
+
+    for (unsigned i = 0; i < sizeof(conditions) / sizeof(conditions[0]); i++)
+    {
+        sim_pad.white = conditions[i].rms * sqrt(TOUCH_SAMPLES);
+        touch_scan_for(SIM_SEC(10));
+
+        uint16_t events = touch_events;
+
+        touch_scan_for(SIM_SEC(30));
+        SIM_EXPECT(touch_events == events, "%s: %u false touches in 30 s",
+                   conditions[i].name, touch_events - events);
+
+        uint8_t threshold = touch_threshold;
+
+        sim_pad.touch = conditions[i].touch;
+        touch_scan_for(SIM_MS(500));
+        sim_pad.touch = 0;
+        touch_scan_for(SIM_MS(500));
+        SIM_EXPECT(touch_events == events + 1, "%s: %.0f-count touch not seen at threshold %u",
+                   conditions[i].name, conditions[i].touch, threshold);
+        sim_report("%-6s %.2f counts rms: threshold %u, %.0f-count touch seen",
+                   conditions[i].name, conditions[i].rms, threshold, conditions[i].touch);
+    }
+
+    SIM_EXPECT(touch_threshold > 2 * TOUCH_THRESHOLD_MIN, "noisy threshold stayed at %u",
+               touch_threshold);
+}
+
+/*
+ * A touch held past TOUCH_MAX_HOLD_SEC is released once, the baseline
+ * restarts under it, and the pad works normally once it is lifted.
+ */
+static void scenario_touch_stuck(void)
+{
+    boot_settled();
+
+    uint64_t start = sim_now;
+
+    sim_pad.touch = 60;
+    SIM_EXPECT(sim_wait_outputs(ALL_LEDS, start + SIM_MS(500)) != SIM_NEVER, "touch not seen");
+
+    uint64_t off = sim_wait_outputs(0, start + SIM_SEC(TOUCH_MAX_HOLD_SEC + 2));
+
+    SIM_EXPECT(off != SIM_NEVER, "held touch not released");
+    SIM_EXPECT(SIM_TO_MS(off - start) >= TOUCH_MAX_HOLD_SEC * 1000.0,
+               "released after %.1f s", SIM_TO_MS(off - start) / 1000);
+
+    sim_run_until(start + SIM_SEC(35));
+    SIM_EXPECT(touch_stuck == 1 && sim_outputs() == 0, "%u stuck releases, outputs %llx",
+               touch_stuck, (unsigned long long)sim_outputs());
+
+    sim_pad.touch = 0;
+    sim_run(SIM_SEC(2));
+
+    uint64_t again = sim_now;
+
+    sim_pad.touch = 60;
+    SIM_EXPECT(sim_wait_outputs(ALL_LEDS, again + SIM_MS(500)) != SIM_NEVER,
+               "no touch after the pad was lifted");
+    sim_report("released %.1f s into a 35 s hold, next touch seen", SIM_TO_MS(off - start) / 1000);
+}
+/* ---------------------------------------------------------------- */
+/* Drift: the untouched pad reading follows temperature and VDD by
+ * DRIFT_KT and DRIFT_KV while the supply and the die run through a
+ * profile. Touches confirmed with no finger on the pad are false
+ * triggers; make drift runs these against a TOUCH_COMPENSATE=0 build
+ * too, for what the correction takes out. */
+
+#define DRIFT_SEC       1800
+#define DRIFT_STEP      SIM_MS(100)
+#define DRIFT_KT        0.8        /* Pad counts per kelvin */
+#define DRIFT_KV        -30.0      /* Pad counts per volt, -0.3 per 10 mV */
+#define DRIFT_NOISE     1.0        /* Pad noise per scan reading, counts rms */
+#define DRIFT_TOUCHES   20
+#define DRIFT_TOUCH_MS  1000
+#define DRIFT_SEEN_MS   1000       /* After a release that a touch still counts */
+#define DRIFT_LEARN_SEC 60         /* Unlearned coefficients may let one through */
+
+typedef struct
+{
+    double vdd;
+    double temp_c;
+    uint8_t finger;
+} drift_point_t;
+
+typedef struct
+{
+    unsigned false_touches;
+    unsigned learning;         /* Of those, in the first DRIFT_LEARN_SEC */
+    unsigned touches;
+    unsigned seen;
+} drift_result_t;
+
+/*
+ * Step the profile over DRIFT_SEC from a settled boot. A confirmed touch
+ * while a finger is on the pad, or DRIFT_SEEN_MS after it left, is the
+ * finger's (the first one); any other is false.
+ */
+static void drift_run(drift_point_t (*profile)(double t), drift_result_t *result)
+{
+    uint64_t start;
+    uint64_t window_end = 0;
+    uint8_t window_seen = 0;
+    uint8_t finger = 0;
+
+    boot_settled();
+    sim_pad.white = DRIFT_NOISE * sqrt(TOUCH_SAMPLES);
+    sim_pad.kt = DRIFT_KT;
+    sim_pad.kv = DRIFT_KV;
+    result->false_touches = result->learning = result->touches = result->seen = 0;
+    start = sim_now;
+
+    while (sim_now - start < SIM_SEC(DRIFT_SEC))
+    {
+        drift_point_t point = profile(SIM_TO_MS(sim_now - start) / 1000);
+        uint16_t events = touch_events;
+
+        sim_vdd = point.vdd;
+        sim_temp_c = point.temp_c;
+
+        if (point.finger && !finger)
+        {
+            result->touches++;
+            window_seen = 0;
+        }
+
+        if (point.finger)
+        {
+            window_end = sim_now + SIM_MS(DRIFT_TOUCH_MS + DRIFT_SEEN_MS);
+        }
+
+        finger = point.finger;
+        sim_pad.touch = finger ? 60 : 0;
+        sim_run(DRIFT_STEP);
+
+        for (uint16_t n = touch_events - events; n; n--)
+        {
+            if (sim_now <= window_end && !window_seen)
+            {
+                window_seen = 1;
+                result->seen++;
+            }
+            else
+            {
+                result->false_touches++;
+                result->learning += (sim_now - start < SIM_SEC(DRIFT_LEARN_SEC));
+            }
+        }
+    }
+}
+
+static void drift_report(const char *profile, const drift_result_t *result)
+{
+#if TOUCH_COMPENSATE
+    sim_report("%s: %u false touches in %d s, %u/%u touches seen, "
+               "kt %.2f counts/K, kv %.2f counts/10 mV",
+               profile, result->false_touches, DRIFT_SEC, result->seen, result->touches,
+               touch_comp_kt / 256.0, touch_comp_kv / 256.0);
+#else
+    sim_report("%s: %u false touches in %d s, %u/%u touches seen, uncompensated",
+               profile, result->false_touches, DRIFT_SEC, result->seen, result->touches);
+#endif
+    SIM_EXPECT(result->seen == result->touches, "%s: %u of %u touches seen",
+               profile, result->seen, result->touches);
+#if TOUCH_COMPENSATE
+    /* Learned, the correction lets nothing through; before that, the
+     * first supply step can get one in at the initial coefficients */
+    SIM_EXPECT(result->learning <= 1, "%s: %u false touches while learning",
+               profile, result->learning);
+    SIM_EXPECT(result->false_touches == result->learning,
+               "%s: %u false touches after %d s with compensation",
+               profile, result->false_touches - result->learning, DRIFT_LEARN_SEC);
+#endif
+}
+
+/* Supply stepping 3.30 <-> 3.00 V every 20 s */
+static drift_point_t drift_supply(double t)
+{
+    drift_point_t point = { ((long)(t / 20) & 1) ? 3.0 : 3.3, 25.0, 0 };
+
+    return point;
+}
+
+/* Die temperature in 2 K steps every 20 s, up 20 K and back */
+static drift_point_t drift_temp(double t)
+{
+    long step = (long)(t / 20) % 20;
+    drift_point_t point = { 3.3, 25.0 + 2 * ((step < 10) ? step : 20 - step), 0 };
+
+    return point;
+}
+
+/* 300 mV sags for 5 s every 40 s, a 10 K swing over 5 minutes and
+ * DRIFT_TOUCHES touches spread over the run */
+static drift_point_t drift_mixed(double t)
+{
+    double touch_every = (double)DRIFT_SEC / DRIFT_TOUCHES;
+    drift_point_t point = {
+        (fmod(t, 40) < 5) ? 3.0 : 3.3,
+        25.0 + 5 * sin(2 * M_PI * t / 300),
+        fmod(t + touch_every / 3, touch_every) < DRIFT_TOUCH_MS / 1000.0,
+    };
+
+    return point;
+}
+
+/* 10 K up and 100 mV down over the whole run */
+static drift_point_t drift_ramp(double t)
+{
+    drift_point_t point = { 3.3 - 0.1 * t / DRIFT_SEC, 25.0 + 10 * t / DRIFT_SEC, 0 };
+
+    return point;
+}
+
+static void scenario_drift_supply(void)
+{
+    drift_result_t result;
+
+    drift_run(drift_supply, &result);
+    drift_report("supply", &result);
+}
+
+static void scenario_drift_temp(void)
+{
+    drift_result_t result;
+
+    drift_run(drift_temp, &result);
+    drift_report("temperature", &result);
+}
+
+static void scenario_drift_mixed(void)
+{
+    drift_result_t result;
+
+    drift_run(drift_mixed, &result);
+    drift_report("mixed", &result);
+}
+
+static void scenario_drift_ramp(void)
+{
+    drift_result_t result;
+
+    drift_run(drift_ramp, &result);
+    drift_report("ramp", &result);
+}
+
+#if TOUCH_COMPENSATE
+/*
+ * A learned coefficient goes to EEPROM with the baseline and the
+ * references it was corrected against. It is set here rather than
+ * learned (the drift scenarios cover that); the save follows the next
+ * untouched scans.
+ */
+static void scenario_touch_save_comp(void)
+{
+    touch_record_t record;
+
+    boot_settled();
+    touch_comp_kv = (int16_t)(DRIFT_KV / 100 * 256);
+
+    sim_pad.touch = 60;
+    sim_run(SIM_MS(300));
+    sim_pad.touch = 0;
+    sim_run(SIM_SEC(2));
+
+    eeprom_read_block(&record, &touch_record, sizeof(record));
+    SIM_EXPECT(record.check == touch_record_check(&record) && record.kv == touch_comp_kv &&
+               record.vdd_ref == touch_vdd_ref && record.temp_ref == touch_temp_ref &&
+               record.baseline == touch_saved, "record kv %d ref %u/%u, live kv %d ref %u/%u",
+               record.kv, record.vdd_ref, record.temp_ref,
+               touch_comp_kv, touch_vdd_ref, touch_temp_ref);
+    sim_report("kv %.2f counts/10 mV saved against %u x 10 mV, %u K",
+               record.kv / 256.0, record.vdd_ref, record.temp_ref);
+}
+
+/*
+ * Powered up at 2.5 V, the pad reads a touch threshold above the
+ * baseline saved at 3.3 V. The restored correction takes that out before
+ * the first scan, so the baseline is kept and a touch at power-up counts.
+ */
+static void scenario_touch_restore_comp(void)
+{
+    sim_pad.white = DRIFT_NOISE * sqrt(TOUCH_SAMPLES);
+    sim_pad.kv = DRIFT_KV;
+    sim_vdd = 2.5;
+
+    sim_boot();
+    sim_run_until(SIM_MS(30));
+    SIM_EXPECT(!touch_calib_blind, "restored baseline dropped, correction %d", touch_comp);
+    SIM_EXPECT(touch_comp_kv == touch_saved_kv && touch_comp_kv, "kv %d not restored",
+               touch_comp_kv);
+
+    sim_pad.touch = 60;
+
+    uint64_t on = sim_wait_outputs(ALL_LEDS, SIM_MS(330));
+
+    SIM_EXPECT(on != SIM_NEVER, "touch at power-up not seen in 300 ms");
+    sim_report("correction %d counts at 2.5 V, lit %.1f ms after power-up",
+               touch_comp, SIM_TO_MS(on));
+}
+
+/*
+ * A record whose CRC matches but whose coefficients are past the clamp
+ * and references off the part's range keeps its baseline, drops the
+ * coefficients and re-anchors the references at the first sample.
+ */
+static void scenario_touch_record_range(void)
+{
+    touch_record_t record = touch_record;
+
+    record.kt = INT16_MAX;
+    record.temp_ref = 0xFFFF;
+    record.vdd_ref = 0xFFFF;
+    record.check = touch_record_check(&record);
+    touch_record = record;
+
+    sim_boot();
+    sim_run_until(SIM_MS(30));
+    SIM_EXPECT(!touch_calib_blind, "baseline dropped");
+    SIM_EXPECT(touch_comp_kt == TOUCH_COMP_KT_INIT, "kt %d restored", touch_comp_kt);
+
+    sim_run_until(SIM_SEC(3));
+    SIM_EXPECT(touch_temp_ref >= TOUCH_COMP_TEMP_MIN && touch_temp_ref <= TOUCH_COMP_TEMP_MAX &&
+               touch_vdd_ref >= TOUCH_COMP_VDD_MIN && touch_vdd_ref <= TOUCH_COMP_VDD_MAX,
+               "references %u K, %u x 10 mV", touch_temp_ref, touch_vdd_ref);
+
+    sim_pad.touch = 60;
+    sim_run(SIM_MS(300));
+    sim_pad.touch = 0;
+    sim_run(SIM_MS(500));
+
+    SIM_EXPECT(touch_events == 1, "%u touch events", touch_events);
+    sim_report("re-anchored at %u K, %u x 10 mV, correction %d",
+               touch_temp_ref, touch_vdd_ref, touch_comp);
+}
+#endif
+#endif
+
+#if TOUCH_STANDBY
+/*
+ * Idle scanning parks: the CPU stays in standby between 4 Hz charges.
+ * Standby is the floor: the next charge is a deadline on the RTC
+ * counter, which power-down would stop.
+ */
+static void scenario_touch_parked(void)
+{
+    sim_stats_t before;
+
+    boot_settled();
+    sim_run_until(SIM_SEC(10));
+    SIM_EXPECT(touch_parked, "not parked after 10 s idle");
+
+    before = sim_stats;
+    sim_run_until(SIM_SEC(70));
+    SIM_EXPECT(touch_parked, "left parked mode");
+    SIM_EXPECT(sim_stats.isr[ADC0_WCOMP_vect_num] == before.isr[ADC0_WCOMP_vect_num],
+               "%u window wakes while idle",
+               sim_stats.isr[ADC0_WCOMP_vect_num] - before.isr[ADC0_WCOMP_vect_num]);
+    SIM_EXPECT(sim_stats.sleeps[2] == before.sleeps[2], "%u power-down sleeps while parked",
+               sim_stats.sleeps[2] - before.sleeps[2]);
+    SIM_EXPECT(sim_stats.asleep[1] - before.asleep[1] > SIM_SEC(59),
+               "%.1f s of 60 parked in standby",
+               SIM_TO_MS(sim_stats.asleep[1] - before.asleep[1]) / 1000);
+    report_power(SIM_SEC(10), &before);
+}
+#endif
+
+#if STRIP_BRIGHTNESS
+/*
+ * Each strip's on-time over a BCM frame matches its level.
+ */
+static void scenario_bcm_levels(void)
+{
+    static const uint8_t levels[4] = { 128, 16, 1, 200 };
+
+    boot_settled();
+
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        strip_brightness(STRIP_BIT(i), levels[i]);
+    }
+
+    sim_motion(1);
+    sim_run(SIM_MS(50));
+    sim_duty_reset();
+    sim_run(SIM_SEC(1));
+
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        double expect = ((i < 4) ? levels[i] : 255) / 255.0;
+        double duty = sim_duty(i);
+
+        SIM_EXPECT(fabs(duty - expect) < 0.002 + expect * 0.01,
+                   "strip %u level %.0f lit %.4f of the time",
+                   i, expect * 255, duty);
+    }
+
+    sim_report("levels 128/16/1/200/255 lit %.4f/%.4f/%.4f/%.4f/%.4f",
+               sim_duty(0), sim_duty(1), sim_duty(2), sim_duty(3), sim_duty(4));
+}
+#endif
+
+#if MOTION_CCL
+/*
+ * The LUT latches the preloaded frame on the sensor edge itself.
+ */
+static void scenario_ccl_latch(void)
+{
+    boot_settled();
+
+    uint64_t awake = sim_stats.awake;
+
+    sim_motion(1);
+    SIM_EXPECT(sim_outputs() == ALL_LEDS && sim_changed_at() == sim_now,
+               "edge didn't latch the motion frame");
+    SIM_EXPECT(sim_stats.awake == awake, "CPU ran before the latch");
+}
+#endif
+
+#if TOUCH_SENSING
+/* ---------------------------------------------------------------- */
+/* Scan quality: SNR of one full scan and what it costs in scan time, so
+ * single-ended and CVD builds (and TOUCH_ADC_ACC choices) compare on the
+ * same pad. Readings are the scan sum over its TOUCH_SAMPLES conversions,
+ * before the firmware's integer shift. SNR^2 per unit time is the
+ * figure that doesn't depend on how many conversions a scan averages. */
+
+#define SNR_SCANS     200
+#define SNR_TOUCH     10.0         /* Touch signal, single-ended counts */
+#define SNR_STEP      SIM_US(10)   /* Polling step for scan edges */
+
+typedef struct
+{
+    double mean;
+    double sigma;
+    double scan_us;
+} snr_run_t;
+
+/*
+ * Collect n full scans. Burst scanning is held on, so the firmware
+ * neither slows down nor parks and every scan is a full one.
+ */
+static void snr_scans(unsigned n, snr_run_t *run)
+{
+    double sum = 0, squares = 0, us = 0;
+    uint64_t start = 0;
+    uint8_t scanning = 0;
+    uint8_t seen_gap = 0;
+    unsigned got = 0;
+
+    while (got < n)
+    {
+        touch_burst_left = TOUCH_BURST_HOLD;
+        sim_run(SNR_STEP);
+
+        if (touch_phase == TOUCH_GAP)
+        {
+            if (scanning && !touch_charges_left)
+            {
+                double reading = (double)touch_sum / TOUCH_SAMPLES;
+
+                sum += reading;
+                squares += reading * reading;
+                us += SIM_TO_US(sim_now - start);
+                got++;
+            }
+
+            scanning = 0;
+            seen_gap = 1;
+        }
+        else if (seen_gap && !scanning)
+        {
+            scanning = 1;
+            start = sim_now;
+        }
+    }
+
+    run->mean = sum / n;
+    run->sigma = sqrt(squares / n - run->mean * run->mean);
+    run->scan_us = us / n;
+}
+
+static void scenario_snr(void)
+{
+    static const struct { const char *name; double white; double hum; } conditions[] = {
+        { "white", 2.0, 0.0 },
+        { "white+hum", 2.0, 20.0 },
+    };
+
+    boot_settled();
+
+    /* A real touch unparks idle scanning; burst scanning is held from here */
+    sim_pad.touch = 60;
+    sim_run(SIM_MS(300));
+    sim_pad.touch = 0;
+    SIM_EXPECT(!touch_parked, "still parked after a touch");
+
+    for (unsigned i = 0; i < sizeof(conditions) / sizeof(conditions[0]); i++)
+    {
+        snr_run_t idle, touched;
+
+        sim_pad.white = conditions[i].white;
+        sim_pad.hum = conditions[i].hum;
+        sim_pad.hum_hz = 50.0;
+
+        sim_pad.touch = 0;
+        snr_scans(SNR_SCANS, &idle);
+        sim_pad.touch = SNR_TOUCH;
+        snr_scans(SNR_SCANS, &touched);
+        sim_pad.touch = 0;
+
+        double signal = touched.mean - idle.mean;
+        double noise = sqrt((idle.sigma * idle.sigma + touched.sigma * touched.sigma) / 2);
+        double snr = signal / noise;
+        double scan_us = (idle.scan_us + touched.scan_us) / 2;
+
+        SIM_EXPECT(fabs(signal - SNR_TOUCH) < 1.0, "%s: touch moved the reading %.2f counts",
+                   conditions[i].name, signal);
+        sim_report("%-10s %2u x ACC%-2u: noise %.3f counts, SNR %.1f per scan, %.0f us/scan, "
+                   "%.4f SNR/us, %.1f SNR^2/ms",
+                   conditions[i].name, TOUCH_CHARGES, TOUCH_ADC_ACC, noise, snr, scan_us,
+                   snr / scan_us, snr * snr * 1000 / scan_us);
+    }
+}
+#endif
+
+/* ---------------------------------------------------------------- */
+/* Benchmark: per-ISR I/O accesses, edge-to-latch latency and sleep
+ * residency, written as JSON to $BENCH_JSON for tracking per commit. The
+ * model charges one step per register access plus a flat SIM_ISR_CYCLES
+ * for the vector and RETI, and nothing for arithmetic, so
+ * "isr_io_accesses" is a proxy for each ISR's I/O work, not a cycle
+ * count. ISR_PROFILE's firmware_stats time ISRs with TCA0, which counts
+ * cycles on the part but the same model steps here. */
+
+#define BENCH_EDGES   8
+
+#ifndef SIM_CONFIG
+#define SIM_CONFIG    "custom"     /* Built outside the Makefile */
+#endif
+
+typedef struct
+{
+    double min;
+    double sum;
+    double max;
+    unsigned count;
+} bench_span_t;
+
+static void bench_add(bench_span_t *span, double value)
+{
+    if (!span->count || value < span->min)
+    {
+        span->min = value;
+    }
+
+    if (value > span->max)
+    {
+        span->max = value;
+    }
+
+    span->sum += value;
+    span->count++;
+}
+
+static void bench_span_json(FILE *out, const char *name, const bench_span_t *span)
+{
+    fprintf(out, "  \"%s\": { \"min\": %.2f, \"mean\": %.2f, \"max\": %.2f, \"count\": %u },\n",
+            name, span->min, span->count ? span->sum / span->count : 0.0, span->max, span->count);
+}
+
+static void bench_json(const bench_span_t *motion, const bench_span_t *touch,
+                       uint64_t since, const sim_stats_t *before)
+{
+    static const struct { uint8_t vect; const char *name; } vectors[] = {
+        { PORTA_PORT_vect_num, "PORTA_PORT_vect" },
+        { RTC_CNT_vect_num, "RTC_CNT_vect" },
+        { TCA0_OVF_vect_num, "TCA0_OVF_vect" },
+        { TCB0_INT_vect_num, "TCB0_INT_vect" },
+        { ADC0_RESRDY_vect_num, "ADC0_RESRDY_vect" },
+        { ADC0_WCOMP_vect_num, "ADC0_WCOMP_vect" },
+        { SPI0_INT_vect_num, "SPI0_INT_vect" },
+    };
+    const char *path = getenv("BENCH_JSON");
+    double span = (double)(sim_now - since);
+
+    if (!path)
+    {
+        return;
+    }
+
+    FILE *out = fopen(path, "w");
+
+    SIM_EXPECT(out, "can't write %s", path);
+
+    fprintf(out, "{\n  \"config\": \"%s\",\n  \"f_cpu\": %lu,\n", SIM_CONFIG, (unsigned long)F_CPU);
+    fprintf(out, "  \"isr_io_accesses\": {\n");
+
+    for (unsigned i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+    {
+        uint8_t v = vectors[i].vect;
+        uint32_t count = sim_stats.isr[v];
+
+        fprintf(out, "    \"%s\": { \"count\": %u, \"mean\": %.1f, \"max\": %u }%s\n",
+                vectors[i].name, count,
+                count ? (double)sim_stats.isr_accesses[v] / count : 0.0, sim_stats.isr_max[v],
+                (i + 1 < sizeof(vectors) / sizeof(vectors[0])) ? "," : "");
+    }
+
+    fprintf(out, "  },\n");
+    bench_span_json(out, "motion_to_latch_us", motion);
+    bench_span_json(out, "touch_to_latch_ms", touch);
+    fprintf(out, "  \"residency_pct\": { \"awake\": %.4f, \"idle\": %.4f, \"standby\": %.4f, "
+            "\"power_down\": %.4f },\n",
+            100.0 * (sim_stats.awake - before->awake) / span,
+            100.0 * (sim_stats.asleep[0] - before->asleep[0]) / span,
+            100.0 * (sim_stats.asleep[1] - before->asleep[1]) / span,
+            100.0 * (sim_stats.asleep[2] - before->asleep[2]) / span);
+
+#if ISR_PROFILE || SLEEP_STATS
+    fprintf(out, "  \"firmware_stats\": {\n    \"version\": %u, \"sections\": %u, \"tick_shift\": %u",
+            stats.version, stats.sections, stats.tick_shift);
+#if ISR_PROFILE
+    static const char *const profiles[PROFILE_COUNT] = {
+        "porta", "rtc", "tcb0", "adc", "spi", "motion"
+    };
+
+    for (uint8_t i = 0; i < PROFILE_COUNT; i++)
+    {
+        fprintf(out, ",\n    \"%s\": { \"min\": %u, \"max\": %u, \"sum\": %lu, \"count\": %u }",
+                profiles[i], stats.isr[i].count ? stats.isr[i].min : 0, stats.isr[i].max,
+                (unsigned long)stats.isr[i].sum, stats.isr[i].count);
+    }
+
+    fprintf(out, ",\n    \"coalesced\": [ ");
+
+    for (uint8_t i = 0; i < EVENT_KINDS; i++)
+    {
+        fprintf(out, "%u%s", stats.coalesced[i], (i + 1 < EVENT_KINDS) ? ", " : " ]");
+    }
+#endif
+#if SLEEP_STATS
+    fprintf(out, ",\n    \"sleep_entries\": [ %u, %u, %u ],\n    \"sleep_ticks\": [ %lu, %lu, %lu ]",
+            stats.sleep_entries[0], stats.sleep_entries[1], stats.sleep_entries[2],
+            (unsigned long)stats.sleep_ticks[0], (unsigned long)stats.sleep_ticks[1],
+            (unsigned long)stats.sleep_ticks[2]);
+#endif
+    fprintf(out, "\n  },\n");
+#endif
+
+    fprintf(out, "  \"virtual_seconds\": %.3f\n}\n", SIM_TO_MS(sim_now) / 1000);
+    fclose(out);
+}
+
+/*
+ * Motion edges, then touches, from a settled idle, with the strips left
+ * to time out in between.
+ */
+static void scenario_bench(void)
+{
+    bench_span_t motion = { 0 };
+    bench_span_t touch = { 0 };
+    sim_stats_t before;
+    uint64_t since;
+
+    boot_settled();
+    since = sim_now;
+    before = sim_stats;
+
+    for (unsigned i = 0; i < BENCH_EDGES; i++)
+    {
+        /* Spread the edges over the RTC tick and the scan cycle */
+        sim_run(SIM_MS(1000) + (uint64_t)(sim_uniform() * SIM_MS(50)));
+
+        uint64_t edge = sim_now;
+
+        sim_motion(1);
+        SIM_EXPECT(sim_wait_outputs(ALL_LEDS, edge + SIM_MS(5)) != SIM_NEVER, "motion not lit");
+        bench_add(&motion, SIM_TO_US(sim_changed_at() - edge));
+        sim_run(SIM_MS(100));
+        sim_motion(0);
+        SIM_EXPECT(sim_wait_outputs(0, sim_now + SIM_MS(TIMEOUT_MS + FADE_MS + 50)) != SIM_NEVER,
+                   "motion didn't time out");
+    }
+
+#if STRIP_BRIGHTNESS
+    /* A second of BCM, so TCA0_OVF_vect is timed too */
+    strip_brightness(STRIP_BIT(0), 128);
+    sim_motion(1);
+    sim_run(SIM_SEC(1));
+    sim_motion(0);
+    SIM_EXPECT(sim_wait_outputs(0, sim_now + SIM_MS(TIMEOUT_MS + FADE_MS + 50)) != SIM_NEVER,
+               "dimmed motion didn't time out");
+    strip_brightness(STRIP_BIT(0), 255);
+#endif
+
+#if TOUCH_SENSING
+    for (unsigned i = 0; i < BENCH_EDGES; i++)
+    {
+        sim_run(SIM_MS(1000) + (uint64_t)(sim_uniform() * SIM_MS(50)));
+
+        uint64_t edge = sim_now;
+
+        sim_pad.touch = 60;
+        SIM_EXPECT(sim_wait_outputs(ALL_LEDS, edge + SIM_MS(500)) != SIM_NEVER, "touch not lit");
+        bench_add(&touch, SIM_TO_MS(sim_changed_at() - edge));
+        sim_run(SIM_MS(300));
+        sim_pad.touch = 0;
+        SIM_EXPECT(sim_wait_outputs(0, sim_now + SIM_MS(500)) != SIM_NEVER, "touch not released");
+    }
+#endif
+
+#if ISR_PROFILE || SLEEP_STATS
+    SIM_EXPECT(stats.magic == STATS_MAGIC && stats.size == sizeof(stats_t),
+               "stats header %04x/%u", stats.magic, stats.size);
+#endif
+#if ISR_PROFILE
+    SIM_EXPECT(stats.isr[PROFILE_PORTA].count == sim_stats.isr[PORTA_PORT_vect_num],
+               "profiled %u PORTA ISRs of %u", stats.isr[PROFILE_PORTA].count,
+               sim_stats.isr[PORTA_PORT_vect_num]);
+    sim_report("events posted while pending: motion %u, timer %u, scan %u, wake %u, sensors %u",
+               stats.coalesced[0], stats.coalesced[1], stats.coalesced[2], stats.coalesced[3],
+               stats.coalesced[5]);
+#endif
+#if SLEEP_STATS
+    uint32_t entries = 0;
+    uint32_t sleeps = 0;
+
+    for (uint8_t i = 0; i < SLEEP_DEPTHS; i++)
+    {
+        entries += stats.sleep_entries[i];
+        sleeps += sim_stats.sleeps[i];
+    }
+
+    /* The last sleep is still running, so it isn't recorded yet */
+    SIM_EXPECT(entries + 1 == sleeps, "counted %u sleeps of %u", entries, sleeps);
+#endif
+
+    sim_report("motion to latch %.1f/%.1f/%.1f us min/mean/max",
+               motion.min, motion.sum / motion.count, motion.max);
+#if TOUCH_SENSING
+    sim_report("touch to latch %.1f/%.1f/%.1f ms min/mean/max",
+               touch.min, touch.sum / touch.count, touch.max);
+    SIM_EXPECT(touch.max < TOUCH_IDLE_MS + TOUCH_CONFIRM_MS, "touch to latch up to %.1f ms",
+               touch.max);
+#endif
+    report_power(since, &before);
+    bench_json(&motion, &touch, since, &before);
+}
+
+/* With MOTION_CCL the LUT latches motion without the PORTA ISR */
+#if TOUCH_SENSING && !MOTION_CCL
+#define BUSY_EDGES    24
+
+/*
+ * Motion edges fired while the CPU is busy with touch scanning: half at
+ * the first register access of the level 0 ISR that woke it (TCB0, ADC0,
+ * RTC), where an edge on the same level waits longest, and half once the
+ * main loop runs after it. Returns the worst latency from the edge to
+ * the PORTA ISR in microseconds for each; the latch follows it by the
+ * frame's transfer (or the next BCM slot) either way.
+ */
+static void motion_busy(double *isr_max, double *loop_max)
+{
+    *isr_max = 0;
+    *loop_max = 0;
+
+    for (unsigned i = 0; i < BUSY_EDGES; i++)
+    {
+        uint64_t give_up = sim_now + SIM_SEC(1);
+
+        touch_burst_left = TOUCH_BURST_HOLD;
+
+        do
+        {
+            SIM_EXPECT(sim_run_to_wake(give_up) != SIM_NEVER, "no scan wake in 1 s");
+
+            while ((i & 1) && !sim_asleep() && sim_isr_level() >= 0)
+            {
+                sim_run(1);
+            }
+        }
+        while (sim_asleep() || sim_isr_level() != ((i & 1) ? -1 : 0));
+
+        uint64_t edge = sim_now;
+        uint32_t entries = sim_stats.isr[PORTA_PORT_vect_num];
+        double *worst = (i & 1) ? loop_max : isr_max;
+
+        sim_motion(1);
+
+        while (sim_stats.isr[PORTA_PORT_vect_num] == entries)
+        {
+            SIM_EXPECT(sim_now < edge + SIM_MS(1), "PORTA ISR not run 1 ms after the edge");
+            sim_run(1);
+        }
+
+        double us = SIM_TO_US(sim_now - edge);
+
+        SIM_EXPECT(sim_wait_outputs(ALL_LEDS, edge + SIM_MS(5)) != SIM_NEVER, "motion not lit");
+
+        if (us > *worst)
+        {
+            *worst = us;
+        }
+
+        sim_run(SIM_MS(100));
+        sim_motion(0);
+        SIM_EXPECT(sim_wait_outputs(0, sim_now + SIM_MS(TIMEOUT_MS + FADE_MS + 50)) != SIM_NEVER,
+                   "motion didn't time out");
+        sim_run_until(sim_now + SIM_MS(1) + (uint64_t)(sim_uniform() * SIM_MS(25)));
+    }
+}
+
+/*
+ * Motion is the one level 1 interrupt, so an edge during a scan preempts
+ * the scan's ISRs instead of waiting for their RETI. Run the edges with
+ * PORTA on level 1, then again with every vector on level 0.
+ */
+static void scenario_motion_busy(void)
+{
+    double lvl1_isr, lvl1_loop, lvl0_isr, lvl0_loop;
+
+    boot_settled();
+    motion_busy(&lvl1_isr, &lvl1_loop);
+
+    CPUINT.LVL1VEC = 0;
+    motion_busy(&lvl0_isr, &lvl0_loop);
+
+    SIM_EXPECT(lvl1_isr <= lvl1_loop, "level 1 edge in a scan ISR %.1f us, in the main loop %.1f us",
+               lvl1_isr, lvl1_loop);
+    SIM_EXPECT(lvl1_isr <= lvl0_isr, "level 1 worst %.1f us, level 0 %.1f us", lvl1_isr, lvl0_isr);
+    sim_report("worst edge to PORTA ISR in a scan ISR %.1f us at level 1, %.1f us at level 0",
+               lvl1_isr, lvl0_isr);
+    sim_report("worst edge to PORTA ISR in the main loop %.1f us at level 1, %.1f us at level 0",
+               lvl1_loop, lvl0_loop);
+}
+#endif
+
+const sim_scenario_t sim_scenarios[] = {
+    { "boot_dark", scenario_boot_dark, 0 },
+    { "motion_timeout", scenario_motion_timeout, 0 },
+    { "motion_retrigger", scenario_motion_retrigger, 0 },
+    { "strip_timeouts", scenario_strip_timeouts, 0 },
+    { "timeout_clamp", scenario_timeout_clamp, 0 },
+#if TOUCH_SENSING
+    { "touch", scenario_touch, 0 },
+    { "touch_save", scenario_touch_save, 0 },
+    { "touch_restore", scenario_touch_restore, 1 },
+    { "touch_record_legacy", scenario_touch_record_legacy, 0 },
+    { "touch_noise", scenario_touch_noise, 0 },
+#if TOUCH_COMPENSATE
+    { "touch_sensors", scenario_touch_sensors, 0 },
+#endif
+    { "touch_stuck", scenario_touch_stuck, 0 },
+    { "drift_supply", scenario_drift_supply, 0 },
+    { "drift_temp", scenario_drift_temp, 0 },
+    { "drift_mixed", scenario_drift_mixed, 0 },
+    { "drift_ramp", scenario_drift_ramp, 0 },
+#if TOUCH_COMPENSATE
+    { "touch_save_comp", scenario_touch_save_comp, 0 },
+    { "touch_restore_comp", scenario_touch_restore_comp, 1 },
+    { "touch_record_range", scenario_touch_record_range, 1 },
+#endif
+#endif
+#if TOUCH_STANDBY
+    { "touch_parked", scenario_touch_parked, 0 },
+#endif
+#if STRIP_BRIGHTNESS
+    { "bcm_levels", scenario_bcm_levels, 0 },
+#endif
+#if MOTION_CCL
+    { "ccl_latch", scenario_ccl_latch, 0 },
+#endif
+    { "long_run", scenario_long_run, 0 },
+#if TOUCH_SENSING
+    { "snr", scenario_snr, 0 },
+#endif
+#if TOUCH_SENSING && !MOTION_CCL
+    { "motion_busy", scenario_motion_busy, 0 },
+#endif
+    { "bench", scenario_bench, 0 },
+};
+
+const unsigned sim_scenario_count = sizeof(sim_scenarios) / sizeof(sim_scenarios[0]);
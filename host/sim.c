@@ -0,0 +1,1627 @@
+/*
+ * sim.c
+ *
+ * Peripheral models, virtual-time scheduler and scenario runner for the
+ * host build of main.c.
+ *
+ * The firmware runs on its own stack. Each register access it makes goes
+ * through sim_io(), which applies the side effects of the access before
+ * it (a strobe, a write-one-to-clear, a timer start), spends one CPU
+ * cycle, and takes any interrupt that is now pending and allowed, so ISRs
+ * preempt main-loop code between accesses as they would on the part.
+ * sleep_cpu() runs time forward event by event until an interrupt wakes
+ * the CPU. Scenarios run on the host stack and resume the firmware up to
+ * a point in virtual time, check the 595 outputs, move the inputs and
+ * resume again.
+ *
+ * The models cover what main.c uses: PORTA pin levels and pin-change
+ * flags, SPI0 in buffer mode, TCA0 single-slope with buffered PER/CMP0,
+ * TCB0 periodic interrupt, ADC0 accumulation and window compare with a
+ * pad model, the RTC counter and compare, CCL LUT0 and its EVSYS strobe,
+ * and the EEPROM. Sleep modes gate the clocks: a sleep that would stall
+ * a running peripheral fails the scenario.
+ */
+
+#define _GNU_SOURCE
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <avr/eeprom.h>
+#include <util/delay.h>
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "sim.h"
+
+#define SIM_ISR_CYCLES   12          /* Vector, prologue and RETI */
+#define SIM_LOG_SIZE     4096
+#define SIM_EEPROM_SIZE  128
+
+/* Register file */
+PORT_t sim_porta;
+VPORT_t sim_vporta;
+SPI_t sim_spi0;
+TCA_t sim_tca0;
+TCB_t sim_tcb0;
+ADC_t sim_adc0;
+RTC_t sim_rtc;
+VREF_t sim_vref;
+SIGROW_t sim_sigrow;
+EVSYS_t sim_evsys;
+CCL_t sim_ccl;
+CPUINT_t sim_cpuint;
+PORTMUX_t sim_portmux;
+FUSE_t sim_fuse;
+volatile uint8_t sim_sreg;
+unsigned char sim_sleep_mode;
+
+uint64_t sim_now;
+sim_stats_t sim_stats;
+sim_pad_t sim_pad = { 400.0, 0.0, 2.0, 0.0, 50.0, 0.0, 0.0 };
+double sim_vdd = 3.3;
+double sim_temp_c = 25.0;
+
+/* Firmware entry points; ISRs a build leaves out resolve to NULL */
+extern int firmware_main(void);
+
+#define SIM_WEAK  __attribute__((weak))
+extern void PORTA_PORT_vect(void) SIM_WEAK;
+extern void RTC_CNT_vect(void) SIM_WEAK;
+extern void TCA0_OVF_vect(void) SIM_WEAK;
+extern void TCB0_INT_vect(void) SIM_WEAK;
+extern void ADC0_RESRDY_vect(void) SIM_WEAK;
+extern void ADC0_WCOMP_vect(void) SIM_WEAK;
+extern void SPI0_INT_vect(void) SIM_WEAK;
+
+extern uint8_t __start_sim_eeprom[] SIM_WEAK;
+extern uint8_t __stop_sim_eeprom[] SIM_WEAK;
+
+/* Execution contexts */
+static ucontext_t fw_ctx;
+static ucontext_t scn_ctx;
+static uint8_t fw_stack[1 << 18];
+static uint8_t fw_running = 0;       /* On the firmware stack */
+static uint8_t fw_booted = 0;
+static uint8_t fw_sleeping = 0;
+static uint8_t pause_on_wake = 0;    /* sim_run_to_wake() running */
+static uint8_t wake_paused = 0;
+static uint8_t pause_on_sleep = 0;
+static uint64_t pause_at = SIM_NEVER;
+static int8_t cpu_level = -1;        /* -1 main, else the ISR level running */
+static const char *scenario_name = "";
+
+/* Shared with the runner so one scenario can boot into another's EEPROM */
+static uint8_t *eeprom_image;
+static uint64_t eeprom_busy_until = 0;
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+/* ---------------------------------------------------------------- */
+/* Noise */
+
+double sim_uniform(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (double)(rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double sim_gauss(void)
+{
+    double u = sim_uniform();
+    double v = sim_uniform();
+
+    if (u < 1e-12)
+    {
+        u = 1e-12;
+    }
+
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/* ---------------------------------------------------------------- */
+/* Results */
+
+void sim_report(const char *fmt, ...)
+{
+    va_list ap;
+
+    printf("    ");
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+}
+
+void sim_fail(const char *fmt, ...)
+{
+    va_list ap;
+
+    printf("    %s failed at %.3f ms: ", scenario_name, SIM_TO_MS(sim_now));
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    fflush(stdout);
+    _exit(1);
+}
+
+/* ---------------------------------------------------------------- */
+/* 74HC595 chain */
+
+static struct
+{
+    uint64_t shift;
+    uint64_t store;
+    uint64_t mask;
+    uint64_t changed_at;
+    uint32_t latches;
+    uint64_t duty_since;
+    uint64_t on[64];
+} chain;
+
+static struct
+{
+    uint64_t t;
+    uint64_t value;
+} output_log[SIM_LOG_SIZE];
+static unsigned output_log_count = 0;
+
+static void chain_shift_bit(uint8_t bit)
+{
+    chain.shift = ((chain.shift << 1) | bit) & chain.mask;
+}
+
+static void chain_shift_byte(uint8_t byte)
+{
+    chain.shift = ((chain.shift << 8) | byte) & chain.mask;
+}
+
+static void chain_latch(void)
+{
+    uint64_t store = chain.store;
+    uint64_t span = sim_now - chain.changed_at;
+
+    chain.latches++;
+
+    if (chain.shift == store)
+    {
+        return;
+    }
+
+    for (unsigned i = 0; i < 64 && store >> i; i++)
+    {
+        if (store & (1ULL << i))
+        {
+            chain.on[i] += span;
+        }
+    }
+
+    chain.store = chain.shift;
+    chain.changed_at = sim_now;
+    output_log[output_log_count % SIM_LOG_SIZE].t = sim_now;
+    output_log[output_log_count % SIM_LOG_SIZE].value = chain.store;
+    output_log_count++;
+}
+
+uint64_t sim_outputs(void)
+{
+    return chain.store;
+}
+
+uint64_t sim_changed_at(void)
+{
+    return chain.changed_at;
+}
+
+uint32_t sim_latches(void)
+{
+    return chain.latches;
+}
+
+void sim_duty_reset(void)
+{
+    memset(chain.on, 0, sizeof(chain.on));
+    chain.duty_since = sim_now;
+
+    /* Time lit so far in the current state doesn't count */
+    for (unsigned i = 0; i < 64; i++)
+    {
+        if (chain.store & (1ULL << i))
+        {
+            chain.on[i] -= sim_now - chain.changed_at;
+        }
+    }
+}
+
+double sim_duty(unsigned strip)
+{
+    uint64_t on = chain.on[strip];
+
+    if (chain.store & (1ULL << strip))
+    {
+        on += sim_now - chain.changed_at;
+    }
+
+    return (double)on / (double)(sim_now - chain.duty_since);
+}
+
+/* ---------------------------------------------------------------- */
+/* PORTA and CCL */
+
+static struct
+{
+    uint8_t out;
+    uint8_t dir;
+    uint8_t ext;         /* Levels the outside world puts on input pins */
+    uint8_t level;       /* Pin levels, what IN reads */
+    uint8_t flags;
+    uint8_t pad_high;    /* PA7 was last driven high */
+    uint8_t ccl_event;   /* EVSYS strobe pulse in progress */
+} port = { 0, 0, PIN2_bm, PIN2_bm, 0, 0, 0 };
+
+static uint8_t ccl_drives_latch(void)
+{
+    return (sim_ccl.CTRLA & CCL_ENABLE_bm) && (sim_ccl.LUT0CTRLA & CCL_ENABLE_bm) &&
+           (sim_ccl.LUT0CTRLA & CCL_OUTEN_bm);
+}
+
+static uint8_t ccl_output(uint8_t level)
+{
+    uint8_t in0 = 0;
+    uint8_t in2 = 0;
+
+    if ((sim_ccl.LUT0CTRLB & CCL_INSEL0_gm) == CCL_INSEL0_EVENT0_gc &&
+        sim_evsys.ASYNCUSER2 == EVSYS_ASYNCUSER_ASYNCCH1_gc)
+    {
+        in0 = port.ccl_event;
+    }
+
+    if ((sim_ccl.LUT0CTRLC & CCL_INSEL2_gm) == CCL_INSEL2_IO_gc)
+    {
+        in2 = (level & PIN2_bm) ? 1 : 0;
+    }
+
+    return (sim_ccl.TRUTH0 >> ((in2 << 2) | in0)) & 1;
+}
+
+static uint8_t spi_enabled(void);
+
+/*
+ * Recompute the pin levels and act on their edges: pin-change flags,
+ * bit-banged SRCLK and RCLK, the pad's charge polarity.
+ */
+static void port_levels(void)
+{
+    uint8_t level = (port.dir & port.out) | (uint8_t)(~port.dir & port.ext);
+
+    if (ccl_drives_latch())
+    {
+        level = (level & ~PIN6_bm) | (ccl_output(level) ? PIN6_bm : 0);
+    }
+
+    uint8_t rise = level & ~port.level;
+    uint8_t fall = port.level & ~level;
+
+    port.level = level;
+
+    if (port.dir & PIN7_bm)
+    {
+        port.pad_high = (port.out & PIN7_bm) ? 1 : 0;
+    }
+
+    for (uint8_t pin = 0; pin < 8; pin++)
+    {
+        uint8_t bit = 1 << pin;
+        uint8_t isc = (&sim_porta.PIN0CTRL)[pin] & PORT_ISC_gm;
+
+        if ((isc == PORT_ISC_BOTHEDGES_gc && ((rise | fall) & bit)) ||
+            (isc == PORT_ISC_RISING_gc && (rise & bit)) ||
+            (isc == PORT_ISC_FALLING_gc && (fall & bit)) ||
+            (isc == PORT_ISC_LEVEL_gc && !(level & bit)))
+        {
+            port.flags |= bit;
+        }
+    }
+
+    if ((rise & PIN3_bm) && !spi_enabled())
+    {
+        chain_shift_bit((level & PIN1_bm) ? 1 : 0);
+    }
+
+    if (rise & PIN6_bm)
+    {
+        chain_latch();
+    }
+}
+
+static void port_apply(void)
+{
+    uint8_t out = port.out;
+    uint8_t dir = port.dir;
+
+    if (sim_porta.OUT != out)
+    {
+        out = sim_porta.OUT;
+    }
+    else if (sim_vporta.OUT != out)
+    {
+        out = sim_vporta.OUT;
+    }
+
+    if (!(sim_porta.OUTSET & SIM_STROBE8)) out |= (uint8_t)sim_porta.OUTSET;
+    if (!(sim_porta.OUTCLR & SIM_STROBE8)) out &= (uint8_t)~sim_porta.OUTCLR;
+    if (!(sim_porta.OUTTGL & SIM_STROBE8)) out ^= (uint8_t)sim_porta.OUTTGL;
+
+    if (sim_porta.DIR != dir)
+    {
+        dir = sim_porta.DIR;
+    }
+    else if (sim_vporta.DIR != dir)
+    {
+        dir = sim_vporta.DIR;
+    }
+
+    if (!(sim_porta.DIRSET & SIM_STROBE8)) dir |= (uint8_t)sim_porta.DIRSET;
+    if (!(sim_porta.DIRCLR & SIM_STROBE8)) dir &= (uint8_t)~sim_porta.DIRCLR;
+    if (!(sim_porta.DIRTGL & SIM_STROBE8)) dir ^= (uint8_t)sim_porta.DIRTGL;
+
+    if (!(sim_porta.INTFLAGS & SIM_STROBE8))
+    {
+        port.flags &= (uint8_t)~sim_porta.INTFLAGS;
+    }
+
+    port.out = out;
+    port.dir = dir;
+
+    if (!(sim_evsys.ASYNCSTROBE & SIM_STROBE8))
+    {
+        if (sim_evsys.ASYNCSTROBE & EVSYS_ASYNCSTROBE_ASYNCCH1_bm)
+        {
+            port.ccl_event = 1;
+            port_levels();
+            port.ccl_event = 0;
+        }
+
+        sim_evsys.ASYNCSTROBE = SIM_STROBE8;
+    }
+
+    port_levels();
+}
+
+static void port_refresh(void)
+{
+    sim_porta.OUT = sim_vporta.OUT = port.out;
+    sim_porta.DIR = sim_vporta.DIR = port.dir;
+    sim_porta.IN = sim_vporta.IN = port.level;
+    sim_porta.INTFLAGS = port.flags | SIM_STROBE8;
+    sim_vporta.INTFLAGS = port.flags;
+    sim_porta.OUTSET = sim_porta.OUTCLR = sim_porta.OUTTGL = SIM_STROBE8;
+    sim_porta.DIRSET = sim_porta.DIRCLR = sim_porta.DIRTGL = SIM_STROBE8;
+}
+
+/* ---------------------------------------------------------------- */
+/* SPI0, buffer mode, master */
+
+static struct
+{
+    uint8_t shifting;
+    uint8_t byte;
+    uint8_t buffered;
+    uint8_t buffer;
+    uint8_t flags;        /* TXCIF and RXCIF; DREIF is derived */
+    uint64_t done_at;
+} spi;
+
+static uint8_t spi_enabled(void)
+{
+    return (sim_spi0.CTRLA & (SPI_ENABLE_bm | SPI_MASTER_bm)) == (SPI_ENABLE_bm | SPI_MASTER_bm);
+}
+
+static uint64_t spi_byte_cycles(void)
+{
+    static const uint8_t div[4] = { 4, 16, 64, 128 };
+    uint64_t cycles = 8ULL * div[(sim_spi0.CTRLA & SPI_PRESC_gm) >> 1];
+
+    return (sim_spi0.CTRLA & SPI_CLK2X_bm) ? cycles / 2 : cycles;
+}
+
+static void spi_shift(uint8_t byte)
+{
+    spi.shifting = 1;
+    spi.byte = byte;
+    spi.done_at = sim_now + spi_byte_cycles();
+}
+
+static void spi_apply(void)
+{
+    if (!spi_enabled() && (spi.shifting || spi.buffered))
+    {
+        spi.shifting = 0;
+        spi.buffered = 0;
+        sim_stats.spi_aborts++;
+    }
+
+    if (!(sim_spi0.INTFLAGS & SIM_STROBE8))
+    {
+        spi.flags &= (uint8_t)~(sim_spi0.INTFLAGS & SPI_TXCIF_bm);
+    }
+
+    if (!(sim_spi0.DATA & SIM_STROBE8))
+    {
+        uint8_t byte = (uint8_t)sim_spi0.DATA;
+
+        if (!spi_enabled())
+        {
+            sim_fail("SPI0.DATA written with SPI0 disabled");
+        }
+
+        if (!spi.shifting)
+        {
+            spi_shift(byte);
+        }
+        else if (!spi.buffered)
+        {
+            spi.buffered = 1;
+            spi.buffer = byte;
+        }
+        else
+        {
+            sim_fail("SPI0 transmit buffer overrun");
+        }
+    }
+}
+
+static void spi_event(void)
+{
+    chain_shift_byte(spi.byte);
+    spi.flags |= SPI_RXCIF_bm;
+
+    if (spi.buffered)
+    {
+        spi.buffered = 0;
+        spi_shift(spi.buffer);
+    }
+    else
+    {
+        spi.shifting = 0;
+        spi.flags |= SPI_TXCIF_bm;
+    }
+}
+
+static uint8_t spi_flags(void)
+{
+    return spi.flags | (spi.buffered ? 0 : SPI_DREIF_bm);
+}
+
+static void spi_refresh(void)
+{
+    sim_spi0.INTFLAGS = spi_flags() | SIM_STROBE8;
+    sim_spi0.DATA = SIM_STROBE8;
+}
+
+/* ---------------------------------------------------------------- */
+/* TCB0, periodic interrupt mode */
+
+static struct
+{
+    uint8_t on;
+    uint8_t flags;
+    uint16_t cnt;         /* Count while stopped, and what CNT shows */
+    uint64_t base;        /* When the count was 0 */
+} tcb;
+
+static uint64_t tcb_div(void)
+{
+    return ((sim_tcb0.CTRLA & TCB_CLKSEL_gm) == TCB_CLKSEL_CLKDIV2_gc) ? 2 : 1;
+}
+
+static uint16_t tcb_count(void)
+{
+    return tcb.on ? (uint16_t)((sim_now - tcb.base) / tcb_div()) : tcb.cnt;
+}
+
+static void tcb_apply(void)
+{
+    if (!(sim_tcb0.INTFLAGS & SIM_STROBE8))
+    {
+        tcb.flags &= (uint8_t)~sim_tcb0.INTFLAGS;
+    }
+
+    if (sim_tcb0.CNT != tcb.cnt)
+    {
+        tcb.cnt = sim_tcb0.CNT;
+        tcb.base = sim_now - tcb.cnt * tcb_div();
+    }
+
+    uint8_t on = sim_tcb0.CTRLA & TCB_ENABLE_bm;
+
+    if (on && !tcb.on)
+    {
+        tcb.base = sim_now - tcb.cnt * tcb_div();
+    }
+    else if (!on && tcb.on)
+    {
+        tcb.cnt = tcb_count();
+    }
+
+    tcb.on = on;
+}
+
+static uint64_t tcb_next(void)
+{
+    if (!tcb.on)
+    {
+        return SIM_NEVER;
+    }
+
+    uint64_t top = (uint64_t)sim_tcb0.CCMP + 1;
+
+    if ((sim_now - tcb.base) / tcb_div() > sim_tcb0.CCMP)
+    {
+        top = 0x10000;
+    }
+
+    return tcb.base + top * tcb_div();
+}
+
+static void tcb_event(void)
+{
+    tcb.flags |= TCB_CAPT_bm;
+    tcb.base = sim_now;
+}
+
+static void tcb_refresh(void)
+{
+    tcb.cnt = tcb_count();
+    sim_tcb0.CNT = tcb.cnt;
+    sim_tcb0.INTFLAGS = tcb.flags | SIM_STROBE8;
+}
+
+/* ---------------------------------------------------------------- */
+/* TCA0, single-slope */
+
+static struct
+{
+    uint8_t on;
+    uint8_t halted;      /* CLK_PER stopped by standby or power-down */
+    uint8_t flags;
+    uint16_t cnt;
+    uint64_t base;
+    uint8_t perbuf_valid;
+    uint16_t perbuf;
+    uint8_t cmp0buf_valid;
+    uint16_t cmp0buf;
+} tca;
+
+static uint64_t tca_div(void)
+{
+    static const uint16_t div[8] = { 1, 2, 4, 8, 16, 64, 256, 1024 };
+
+    return div[(sim_tca0.SINGLE.CTRLA & TCA_SINGLE_CLKSEL_gm) >> 1];
+}
+
+static uint16_t tca_count(void)
+{
+    return (tca.on && !tca.halted) ? (uint16_t)((sim_now - tca.base) / tca_div()) : tca.cnt;
+}
+
+static void tca_apply(void)
+{
+    TCA_SINGLE_t *t = &sim_tca0.SINGLE;
+
+    if (!(t->INTFLAGS & SIM_STROBE8))
+    {
+        tca.flags &= (uint8_t)~t->INTFLAGS;
+    }
+
+    if (t->CNT != tca.cnt)
+    {
+        tca.cnt = t->CNT;
+        tca.base = sim_now - tca.cnt * tca_div();
+    }
+
+    if (!(t->PERBUF & SIM_STROBE16))
+    {
+        tca.perbuf = (uint16_t)t->PERBUF;
+        tca.perbuf_valid = 1;
+    }
+
+    if (!(t->CMP0BUF & SIM_STROBE16))
+    {
+        tca.cmp0buf = (uint16_t)t->CMP0BUF;
+        tca.cmp0buf_valid = 1;
+    }
+
+    uint8_t on = t->CTRLA & TCA_SINGLE_ENABLE_bm;
+
+    if (on && !tca.on)
+    {
+        tca.base = sim_now - tca.cnt * tca_div();
+    }
+    else if (!on && tca.on)
+    {
+        tca.cnt = tca_count();
+    }
+
+    tca.on = on;
+}
+
+static uint64_t tca_next(void)
+{
+    if (!tca.on || tca.halted)
+    {
+        return SIM_NEVER;
+    }
+
+    uint64_t top = (uint64_t)sim_tca0.SINGLE.PER + 1;
+
+    if ((sim_now - tca.base) / tca_div() > sim_tca0.SINGLE.PER)
+    {
+        top = 0x10000;
+    }
+
+    return tca.base + top * tca_div();
+}
+
+static void tca_event(void)
+{
+    tca.flags |= TCA_SINGLE_OVF_bm;
+    tca.base = sim_now;
+
+    if (tca.perbuf_valid)
+    {
+        sim_tca0.SINGLE.PER = tca.perbuf;
+        tca.perbuf_valid = 0;
+    }
+
+    if (tca.cmp0buf_valid)
+    {
+        sim_tca0.SINGLE.CMP0 = tca.cmp0buf;
+        tca.cmp0buf_valid = 0;
+    }
+}
+
+/* TCA0 has no RUNSTDBY: the count holds while CLK_PER is stopped */
+static void tca_freeze(uint8_t frozen)
+{
+    if (frozen && tca.on && !tca.halted)
+    {
+        tca.cnt = tca_count();
+        tca.halted = 1;
+    }
+    else if (!frozen && tca.halted)
+    {
+        tca.base = sim_now - tca.cnt * tca_div();
+        tca.halted = 0;
+    }
+}
+
+static void tca_refresh(void)
+{
+    TCA_SINGLE_t *t = &sim_tca0.SINGLE;
+
+    tca.cnt = tca_count();
+    t->CNT = tca.cnt;
+    t->INTFLAGS = tca.flags | SIM_STROBE8;
+    t->PERBUF = tca.perbuf | SIM_STROBE16;
+    t->CMP0BUF = tca.cmp0buf | SIM_STROBE16;
+}
+
+/* ---------------------------------------------------------------- */
+/* ADC0 and the pad */
+
+static struct
+{
+    uint8_t converting;
+    uint8_t flags;
+    uint8_t mux;          /* MUXPOS as last seen */
+    uint8_t precharge;    /* MUXPOS before AIN7 was selected: the S/H's charge */
+    uint16_t result;
+    uint64_t done_at;
+} adc = { 0, 0, 0, ADC_MUXPOS_GND_gc, 0, 0 };
+
+/*
+ * One conversion. The floating pad reads its single-ended level after a
+ * pad-HIGH / S&H-at-GND charge and the mirror of it after a pad-LOW /
+ * S&H-at-VREF one; common-mode interference moves both the same way.
+ */
+static double adc_sample(uint8_t mux, uint64_t at)
+{
+    double volts = sim_vdd;
+
+    if ((sim_adc0.CTRLC & ADC_REFSEL_gm) == ADC_REFSEL_INTREF_gc)
+    {
+        volts = 1.1;
+    }
+
+    switch (mux)
+    {
+    case ADC_MUXPOS_AIN7_gc:
+    {
+        double t = (double)at / F_CPU;
+        double level = sim_pad.level + sim_pad.touch +
+                       sim_pad.kt * (sim_temp_c - 25.0) + sim_pad.kv * (sim_vdd - 3.3);
+        double common = sim_pad.hum * sin(2.0 * M_PI * sim_pad.hum_hz * t);
+
+        if (port.dir & PIN7_bm)
+        {
+            return (port.out & PIN7_bm) ? 1023.0 : 0.0;
+        }
+
+        if (port.pad_high && adc.precharge == ADC_MUXPOS_GND_gc)
+        {
+            return level + common + sim_pad.white * sim_gauss();
+        }
+
+        if (!port.pad_high && adc.precharge == ADC_MUXPOS_INTREF_gc)
+        {
+            return 1023.0 - level + common + sim_pad.white * sim_gauss();
+        }
+
+        sim_stats.bad_precharge++;
+        return 512.0;
+    }
+    case ADC_MUXPOS_INTREF_gc:
+        return 1.1 / volts * 1023.0 + 0.3 * sim_gauss();
+    case ADC_MUXPOS_TEMPSENSE_gc:
+        return (sim_temp_c + 273.15) * 256.0 / sim_sigrow.TEMPSENSE0 +
+               (int8_t)sim_sigrow.TEMPSENSE1 + 0.3 * sim_gauss();
+    default:
+        return 0.0;
+    }
+}
+
+static void adc_start(void)
+{
+    uint8_t count = 1 << (sim_adc0.CTRLB & ADC_SAMPNUM_gm);
+    uint64_t clock = 2ULL << (sim_adc0.CTRLC & ADC_PRESC_gm);
+    uint64_t each = (13 + 2 + (sim_adc0.SAMPCTRL & 0x1F)) * clock;
+    uint32_t sum = 0;
+
+    /* Each accumulated conversion samples at its own time */
+    for (uint8_t i = 0; i < count; i++)
+    {
+        double v = floor(adc_sample(adc.mux, sim_now + i * each) + 0.5);
+
+        sum += (v < 0) ? 0 : (v > 1023) ? 1023 : (uint16_t)v;
+    }
+
+    adc.converting = 1;
+    adc.result = (uint16_t)sum;
+    adc.done_at = sim_now + count * each;
+}
+
+static void adc_apply(void)
+{
+    if (!(sim_adc0.INTFLAGS & SIM_STROBE8))
+    {
+        adc.flags &= (uint8_t)~sim_adc0.INTFLAGS;
+    }
+
+    if (sim_adc0.MUXPOS != adc.mux)
+    {
+        if (sim_adc0.MUXPOS == ADC_MUXPOS_AIN7_gc)
+        {
+            adc.precharge = adc.mux;
+        }
+
+        adc.mux = sim_adc0.MUXPOS;
+    }
+
+    if ((sim_adc0.COMMAND & ADC_STCONV_bm) && !adc.converting)
+    {
+        if (!(sim_adc0.CTRLA & ADC_ENABLE_bm))
+        {
+            sim_fail("ADC0 conversion started with ADC0 disabled");
+        }
+
+        adc_start();
+    }
+}
+
+static void adc_event(void)
+{
+    uint16_t res = adc.result;
+
+    adc.converting = 0;
+    sim_adc0.COMMAND &= (uint8_t)~ADC_STCONV_bm;
+    sim_adc0.RES = res;
+    adc.flags |= ADC_RESRDY_bm;
+    sim_stats.conversions++;
+
+    switch (sim_adc0.CTRLE & ADC_WINCM_gm)
+    {
+    case ADC_WINCM_BELOW_gc:
+        if (res < sim_adc0.WINLT) adc.flags |= ADC_WCMP_bm;
+        break;
+    case ADC_WINCM_ABOVE_gc:
+        if (res > sim_adc0.WINHT) adc.flags |= ADC_WCMP_bm;
+        break;
+    case ADC_WINCM_INSIDE_gc:
+        if (res >= sim_adc0.WINLT && res <= sim_adc0.WINHT) adc.flags |= ADC_WCMP_bm;
+        break;
+    case ADC_WINCM_OUTSIDE_gc:
+        if (res < sim_adc0.WINLT || res > sim_adc0.WINHT) adc.flags |= ADC_WCMP_bm;
+        break;
+    }
+}
+
+static void adc_refresh(void)
+{
+    sim_adc0.INTFLAGS = adc.flags | SIM_STROBE8;
+}
+
+/* ---------------------------------------------------------------- */
+/* RTC, counting the internal 32.768 kHz oscillator */
+
+static struct
+{
+    uint8_t on;
+    uint8_t running;      /* Stops in power-down */
+    uint8_t flags;
+    uint8_t shift;        /* Prescaler */
+    uint64_t elapsed;     /* Cycles counted before since */
+    uint64_t since;
+} rtc;
+
+static uint64_t rtc_ticks(void)
+{
+    uint64_t cycles = rtc.elapsed + (rtc.running ? sim_now - rtc.since : 0);
+
+    return ((cycles * 32768) / F_CPU) >> rtc.shift;
+}
+
+static void rtc_apply(void)
+{
+    if (!(sim_rtc.INTFLAGS & SIM_STROBE8))
+    {
+        rtc.flags &= (uint8_t)~sim_rtc.INTFLAGS;
+    }
+
+    if ((sim_rtc.CTRLA & RTC_RTCEN_bm) && !rtc.on)
+    {
+        rtc.on = 1;
+        rtc.running = 1;
+        rtc.elapsed = 0;
+        rtc.since = sim_now;
+        rtc.shift = (sim_rtc.CTRLA & RTC_PRESCALER_gm) >> RTC_PRESCALER_gp;
+    }
+}
+
+static uint64_t rtc_next(void)
+{
+    if (!rtc.on || !rtc.running)
+    {
+        return SIM_NEVER;
+    }
+
+    uint64_t ticks = rtc_ticks();
+    uint64_t target = ticks + (uint16_t)(sim_rtc.CMP - (uint16_t)ticks);
+
+    if (target == ticks)
+    {
+        target += 0x10000;
+    }
+
+    uint64_t raw = target << rtc.shift;
+    uint64_t cycles = (raw * F_CPU + 32767) / 32768;
+
+    return rtc.since + cycles - rtc.elapsed;
+}
+
+static void rtc_event(void)
+{
+    rtc.flags |= RTC_CMP_bm;
+}
+
+static void rtc_freeze(uint8_t frozen)
+{
+    if (!rtc.on)
+    {
+        return;
+    }
+
+    if (frozen && rtc.running)
+    {
+        rtc.elapsed += sim_now - rtc.since;
+        rtc.running = 0;
+    }
+    else if (!frozen && !rtc.running)
+    {
+        rtc.since = sim_now;
+        rtc.running = 1;
+    }
+}
+
+static void rtc_refresh(void)
+{
+    sim_rtc.CNT = (uint16_t)rtc_ticks();
+    sim_rtc.STATUS = 0;
+    sim_rtc.INTFLAGS = rtc.flags | SIM_STROBE8;
+}
+
+/* ---------------------------------------------------------------- */
+/* EEPROM */
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, src, n);
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+    if (!eeprom_is_ready())
+    {
+        sim_fail("EEPROM written while busy");
+    }
+
+    if (*addr != value)
+    {
+        *addr = value;
+        sim_stats.eeprom_writes++;
+        eeprom_busy_until = sim_now + SIM_MS(4);
+    }
+}
+
+int eeprom_is_ready(void)
+{
+    return sim_now >= eeprom_busy_until;
+}
+
+static size_t eeprom_size(void)
+{
+    return __start_sim_eeprom ? (size_t)(__stop_sim_eeprom - __start_sim_eeprom) : 0;
+}
+
+/* ---------------------------------------------------------------- */
+/* Scheduler */
+
+/*
+ * Park the write-detect bits before the firmware's first access.
+ */
+static void models_init(void)
+{
+    sim_evsys.ASYNCSTROBE = SIM_STROBE8;
+    port_refresh();
+    spi_refresh();
+    tcb_refresh();
+    tca_refresh();
+    adc_refresh();
+    rtc_refresh();
+}
+
+static void sync_all(void)
+{
+    port_apply();
+    spi_apply();
+    tcb_apply();
+    tca_apply();
+    adc_apply();
+    rtc_apply();
+
+    port_refresh();
+    spi_refresh();
+    tcb_refresh();
+    tca_refresh();
+    adc_refresh();
+    rtc_refresh();
+}
+
+/* Next event time of each model */
+enum
+{
+    EVENT_SPI,
+    EVENT_TCB,
+    EVENT_TCA,
+    EVENT_ADC,
+    EVENT_RTC,
+    EVENT_SOURCES
+};
+
+static uint64_t next_events(uint64_t due[EVENT_SOURCES])
+{
+    uint64_t next = SIM_NEVER;
+
+    due[EVENT_SPI] = spi.shifting ? spi.done_at : SIM_NEVER;
+    due[EVENT_TCB] = tcb_next();
+    due[EVENT_TCA] = tca_next();
+    due[EVENT_ADC] = adc.converting ? adc.done_at : SIM_NEVER;
+    due[EVENT_RTC] = rtc_next();
+
+    for (unsigned i = 0; i < EVENT_SOURCES; i++)
+    {
+        if (due[i] < next)
+        {
+            next = due[i];
+        }
+    }
+
+    return next;
+}
+
+static uint64_t next_event(void)
+{
+    uint64_t due[EVENT_SOURCES];
+
+    return next_events(due);
+}
+
+/*
+ * Run the models forward to t, event by event. Each event fires at the
+ * time computed before it, since a model asked again at that time already
+ * sees the next one.
+ */
+static void advance_to(uint64_t t)
+{
+    for (;;)
+    {
+        uint64_t due[EVENT_SOURCES];
+        uint64_t next = next_events(due);
+
+        if (next > t)
+        {
+            break;
+        }
+
+        if (next > sim_now)
+        {
+            sim_now = next;
+        }
+
+        if (due[EVENT_SPI] == next) spi_event();
+        if (due[EVENT_TCB] == next) tcb_event();
+        if (due[EVENT_TCA] == next) tca_event();
+        if (due[EVENT_ADC] == next) adc_event();
+        if (due[EVENT_RTC] == next) rtc_event();
+    }
+
+    if (t > sim_now)
+    {
+        sim_now = t;
+    }
+}
+
+/* Interrupt sources in priority order (lowest vector first) */
+static uint8_t irq_flagged(uint8_t vect)
+{
+    switch (vect)
+    {
+    case PORTA_PORT_vect_num:
+        return port.flags != 0;
+    case RTC_CNT_vect_num:
+        return (rtc.flags & sim_rtc.INTCTRL & (RTC_CMP_bm | RTC_OVF_bm)) != 0;
+    case TCA0_OVF_vect_num:
+        return (tca.flags & sim_tca0.SINGLE.INTCTRL & TCA_SINGLE_OVF_bm) != 0;
+    case TCB0_INT_vect_num:
+        return (tcb.flags & sim_tcb0.INTCTRL & TCB_CAPT_bm) != 0;
+    case ADC0_RESRDY_vect_num:
+        return (adc.flags & sim_adc0.INTCTRL & ADC_RESRDY_bm) != 0;
+    case ADC0_WCOMP_vect_num:
+        return (adc.flags & sim_adc0.INTCTRL & ADC_WCMP_bm) != 0;
+    case SPI0_INT_vect_num:
+    {
+        uint8_t enabled = 0;
+
+        if (sim_spi0.INTCTRL & SPI_DREIE_bm) enabled |= SPI_DREIF_bm;
+        if (sim_spi0.INTCTRL & SPI_TXCIE_bm) enabled |= SPI_TXCIF_bm;
+        if (sim_spi0.INTCTRL & SPI_RXCIE_bm) enabled |= SPI_RXCIF_bm;
+
+        return (spi_flags() & enabled) != 0;
+    }
+    }
+
+    return 0;
+}
+
+static void (*irq_handler(uint8_t vect))(void)
+{
+    switch (vect)
+    {
+    case PORTA_PORT_vect_num:  return PORTA_PORT_vect;
+    case RTC_CNT_vect_num:     return RTC_CNT_vect;
+    case TCA0_OVF_vect_num:    return TCA0_OVF_vect;
+    case TCB0_INT_vect_num:    return TCB0_INT_vect;
+    case ADC0_RESRDY_vect_num: return ADC0_RESRDY_vect;
+    case ADC0_WCOMP_vect_num:  return ADC0_WCOMP_vect;
+    case SPI0_INT_vect_num:    return SPI0_INT_vect;
+    }
+
+    return NULL;
+}
+
+static const uint8_t irq_vectors[] = {
+    PORTA_PORT_vect_num, RTC_CNT_vect_num, TCA0_OVF_vect_num, TCB0_INT_vect_num,
+    ADC0_RESRDY_vect_num, ADC0_WCOMP_vect_num, SPI0_INT_vect_num
+};
+
+/*
+ * The interrupt the CPU would take now: level 1 first, then the lowest
+ * vector, and only above the level already running. 0 if none.
+ */
+static uint8_t irq_pick(void)
+{
+    uint8_t pick = 0;
+
+    for (unsigned i = 0; i < sizeof(irq_vectors); i++)
+    {
+        uint8_t vect = irq_vectors[i];
+        int8_t level = (sim_cpuint.LVL1VEC == vect) ? 1 : 0;
+
+        if (level <= cpu_level || !irq_flagged(vect))
+        {
+            continue;
+        }
+
+        if (!irq_handler(vect))
+        {
+            sim_fail("vector %u enabled with no ISR", vect);
+        }
+
+        if (level)
+        {
+            return vect;
+        }
+
+        if (!pick)
+        {
+            pick = vect;
+        }
+    }
+
+    return pick;
+}
+
+static void step(uint64_t cycles);
+
+static void irq_poll(void)
+{
+    static uint32_t stuck[32];
+
+    while (sim_sreg & CPU_I_bm)
+    {
+        sync_all();
+
+        uint8_t vect = irq_pick();
+
+        if (!vect)
+        {
+            return;
+        }
+
+        int8_t saved = cpu_level;
+        uint64_t entry = sim_stats.awake;
+
+        cpu_level = (sim_cpuint.LVL1VEC == vect) ? 1 : 0;
+        sim_stats.isr[vect]++;
+        step(SIM_ISR_CYCLES / 2);
+        irq_handler(vect)();
+        step(SIM_ISR_CYCLES / 2);
+        sync_all();
+
+        uint64_t accesses = sim_stats.awake - entry;
+
+        sim_stats.isr_accesses[vect] += accesses;
+        if (accesses > sim_stats.isr_max[vect])
+        {
+            sim_stats.isr_max[vect] = (uint32_t)accesses;
+        }
+
+        /* Reading RES clears RESRDY */
+        if (vect == ADC0_RESRDY_vect_num)
+        {
+            adc.flags &= (uint8_t)~ADC_RESRDY_bm;
+            adc_refresh();
+        }
+
+        cpu_level = saved;
+
+        if (irq_flagged(vect) && ++stuck[vect] > 10000)
+        {
+            sim_fail("vector %u still flagged after its ISR, 10000 times running", vect);
+        }
+        else if (!irq_flagged(vect))
+        {
+            stuck[vect] = 0;
+        }
+    }
+}
+
+static void step(uint64_t cycles)
+{
+    sim_stats.awake += cycles;
+    advance_to(sim_now + cycles);
+    sync_all();
+}
+
+static void fw_pause(void)
+{
+    swapcontext(&fw_ctx, &scn_ctx);
+}
+
+static void fw_resume(void)
+{
+    fw_running = 1;
+    swapcontext(&scn_ctx, &fw_ctx);
+    fw_running = 0;
+}
+
+void *sim_io(volatile void *reg)
+{
+    sync_all();
+
+    if (fw_running && !fw_sleeping)
+    {
+        step(1);
+        irq_poll();
+
+        if (sim_now >= pause_at)
+        {
+            fw_pause();
+        }
+    }
+
+    return (void *)reg;
+}
+
+void sim_delay_cycles(unsigned long cycles)
+{
+    while (cycles)
+    {
+        unsigned long chunk = (cycles > 16) ? 16 : cycles;
+
+        step(chunk);
+        irq_poll();
+        cycles -= chunk;
+    }
+}
+
+static unsigned sleep_index(uint8_t mode)
+{
+    return (mode == SLEEP_MODE_PWR_DOWN) ? 2 : (mode == SLEEP_MODE_STANDBY) ? 1 : 0;
+}
+
+/*
+ * What the chosen sleep mode would stop that is still running. CLK_PER
+ * stops in standby (TCA0 just holds its count); the RTC counter and ADC0
+ * also stop in power-down.
+ */
+static void sleep_check(unsigned depth)
+{
+    static const char *const names[3] = { "idle", "standby", "power-down" };
+
+    if (depth >= 1)
+    {
+        if (spi.shifting || spi.buffered)
+        {
+            sim_fail("%s with an SPI0 transfer in flight", names[depth]);
+        }
+
+        if (tcb.on)
+        {
+            sim_fail("%s with TCB0 running", names[depth]);
+        }
+
+        if (tca.on && (sim_tca0.SINGLE.INTCTRL & TCA_SINGLE_OVF_bm))
+        {
+            sim_fail("%s waiting on a TCA0 overflow", names[depth]);
+        }
+
+        if (adc.converting && (depth == 2 || !(sim_adc0.CTRLA & ADC_RUNSTBY_bm)))
+        {
+            sim_fail("%s with an ADC0 conversion running", names[depth]);
+        }
+    }
+
+    if (depth == 2 && (sim_rtc.INTCTRL & RTC_CMP_bm))
+    {
+        sim_fail("power-down with an RTC deadline armed");
+    }
+}
+
+/* sim_stats.awake at the last wake */
+static uint64_t woke_awake;
+
+/*
+ * sleep_cpu(): run time forward to the next interrupt the CPU takes, or
+ * hand back to the scenario when its run is up.
+ */
+void sim_sleep(void)
+{
+    unsigned depth = sleep_index(sim_sleep_mode);
+
+    if (!fw_running)
+    {
+        sim_fail("sleep_cpu() outside the firmware");
+    }
+
+    if (!(sim_sreg & CPU_I_bm))
+    {
+        sim_fail("sleep with interrupts disabled");
+    }
+
+    sync_all();
+    sleep_check(depth);
+    sim_stats.sleeps[depth]++;
+
+    if (sim_stats.awake - woke_awake > sim_stats.awake_max)
+    {
+        sim_stats.awake_max = sim_stats.awake - woke_awake;
+    }
+
+    fw_sleeping = 1;
+    rtc_freeze(depth == 2);
+    tca_freeze(depth >= 1);
+
+    for (;;)
+    {
+        if (pause_on_sleep)
+        {
+            fw_pause();
+            continue;
+        }
+
+        if (irq_pick())
+        {
+            break;
+        }
+
+        uint64_t next = next_event();
+        uint64_t until = (next < pause_at) ? next : pause_at;
+
+        if (until < sim_now)
+        {
+            until = sim_now;
+        }
+
+        if (until == SIM_NEVER)
+        {
+            sim_fail("asleep with nothing left to wake the CPU");
+        }
+
+        sim_stats.asleep[depth] += until - sim_now;
+        advance_to(until);
+        sync_all();
+
+        if (sim_now >= pause_at && !irq_pick())
+        {
+            fw_pause();
+        }
+    }
+
+    rtc_freeze(0);
+    tca_freeze(0);
+    fw_sleeping = 0;
+    woke_awake = sim_stats.awake;
+
+    if (pause_on_wake)
+    {
+        /* The waking ISR's first register access pauses */
+        pause_at = sim_now;
+        wake_paused = 1;
+    }
+
+    irq_poll();
+}
+
+/* ---------------------------------------------------------------- */
+/* Scenario calls */
+
+static void fw_entry(void)
+{
+    firmware_main();
+    sim_fail("main() returned");
+}
+
+void sim_boot(void)
+{
+    chain.mask = (sim_chain_length >= 8) ? ~0ULL : (1ULL << (8 * sim_chain_length)) - 1;
+    sim_sigrow.TEMPSENSE0 = 128;
+    sim_sigrow.TEMPSENSE1 = 0;
+    sync_all();
+
+    getcontext(&fw_ctx);
+    fw_ctx.uc_stack.ss_sp = fw_stack;
+    fw_ctx.uc_stack.ss_size = sizeof(fw_stack);
+    fw_ctx.uc_link = NULL;
+    makecontext(&fw_ctx, fw_entry, 0);
+
+    fw_booted = 1;
+    pause_on_sleep = 1;
+    fw_resume();
+    pause_on_sleep = 0;
+}
+
+void sim_run_until(uint64_t t)
+{
+    if (!fw_booted)
+    {
+        sim_fail("sim_run_until() before sim_boot()");
+    }
+
+    if (t <= sim_now)
+    {
+        return;
+    }
+
+    pause_at = t;
+    fw_resume();
+    pause_at = SIM_NEVER;
+}
+
+void sim_run(uint64_t cycles)
+{
+    sim_run_until(sim_now + cycles);
+}
+
+/*
+ * Run until the CPU next wakes, pausing at the first register access of
+ * the ISR that woke it; SIM_NEVER if it sleeps through the deadline.
+ */
+uint64_t sim_run_to_wake(uint64_t deadline)
+{
+    wake_paused = 0;
+    pause_on_wake = 1;
+    sim_run_until(deadline);
+    pause_on_wake = 0;
+
+    return wake_paused ? sim_now : SIM_NEVER;
+}
+
+int sim_asleep(void)
+{
+    return fw_sleeping;
+}
+
+int sim_isr_level(void)
+{
+    return cpu_level;
+}
+
+void sim_motion(int detected)
+{
+    port.ext = detected ? (port.ext & ~PIN2_bm) : (port.ext | PIN2_bm);
+    port_levels();
+    port_refresh();
+}
+
+/*
+ * Run until the outputs show value, in 100 us slices, and return when
+ * the latch that showed it happened; SIM_NEVER if not by the deadline.
+ */
+uint64_t sim_wait_outputs(uint64_t value, uint64_t deadline)
+{
+    while (chain.store != value)
+    {
+        if (sim_now >= deadline)
+        {
+            return SIM_NEVER;
+        }
+
+        uint64_t next = sim_now + SIM_US(100);
+
+        sim_run_until((next < deadline) ? next : deadline);
+    }
+
+    return chain.changed_at;
+}
+
+/* ---------------------------------------------------------------- */
+/* Runner */
+
+static void run_scenario(const sim_scenario_t *scenario)
+{
+    size_t size = eeprom_size();
+
+    scenario_name = scenario->name;
+
+    if (size > SIM_EEPROM_SIZE)
+    {
+        sim_fail("EEMEM data is %zu bytes, the part has %u", size, SIM_EEPROM_SIZE);
+    }
+
+    if (size)
+    {
+        memcpy(__start_sim_eeprom, eeprom_image, size);
+    }
+
+    models_init();
+    alarm(120);
+    scenario->run();
+
+    if (size)
+    {
+        memcpy(eeprom_image, __start_sim_eeprom, size);
+    }
+
+    fflush(stdout);
+    _exit(0);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned passed = 0;
+    unsigned failed = 0;
+
+    eeprom_image = mmap(NULL, SIM_EEPROM_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (eeprom_image == MAP_FAILED)
+    {
+        perror("mmap");
+        return 2;
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    for (unsigned i = 0; i < sim_scenario_count; i++)
+    {
+        const sim_scenario_t *scenario = &sim_scenarios[i];
+        int selected = (argc < 2);
+
+        for (int a = 1; a < argc; a++)
+        {
+            if (!strcmp(argv[a], scenario->name))
+            {
+                selected = 1;
+            }
+        }
+
+        if (!selected)
+        {
+            continue;
+        }
+
+        if (!scenario->keep_eeprom)
+        {
+            memset(eeprom_image, 0xFF, SIM_EEPROM_SIZE);
+        }
+
+        struct timespec start, end;
+        int status = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        printf("%-24s\n", scenario->name);
+
+        pid_t pid = fork();
+
+        if (pid == 0)
+        {
+            run_scenario(scenario);
+        }
+
+        waitpid(pid, &status, 0);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+        int ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+        if (!ok && WIFSIGNALED(status))
+        {
+            printf("    killed by signal %d\n", WTERMSIG(status));
+        }
+
+        printf("  %s (%.2f s)\n", ok ? "ok" : "FAILED", wall);
+
+        if (ok)
+        {
+            passed++;
+        }
+        else
+        {
+            failed++;
+        }
+    }
+
+    printf("%u passed, %u failed\n", passed, failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * sim.h
+ *
+ * Host simulation of the ATtiny412 around main.c: the peripheral models,
+ * the virtual-time scheduler and the 74HC595 chain, plus the calls the
+ * scenarios drive them with. Time is counted in CPU cycles at F_CPU.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#define SIM_US(us)    ((uint64_t)(us) * F_CPU / 1000000)
+#define SIM_MS(ms)    ((uint64_t)(ms) * F_CPU / 1000)
+#define SIM_SEC(s)    ((uint64_t)(s) * F_CPU)
+#define SIM_TO_MS(t)  ((double)(t) * 1000.0 / F_CPU)
+#define SIM_TO_US(t)  ((double)(t) * 1000000.0 / F_CPU)
+#define SIM_NEVER     UINT64_MAX
+
+/* A scenario runs in its own process, so every one boots a fresh image.
+ * keep_eeprom boots it with the EEPROM the previous scenario left. */
+typedef struct
+{
+    const char *name;
+    void (*run)(void);
+    uint8_t keep_eeprom;
+} sim_scenario_t;
+
+extern const sim_scenario_t sim_scenarios[];
+extern const unsigned sim_scenario_count;
+extern const uint8_t sim_chain_length;   /* CHAIN_LENGTH of this build */
+
+extern uint64_t sim_now;
+
+/* Firmware control. sim_boot() runs main() up to its first sleep; the run
+ * calls return once virtual time reaches the target, which may be in the
+ * middle of an ISR (sim_isr_level(): -1 in main(), else the ISR's level). */
+void sim_boot(void);
+void sim_run_until(uint64_t t);
+void sim_run(uint64_t cycles);
+uint64_t sim_run_to_wake(uint64_t deadline);
+int sim_asleep(void);
+int sim_isr_level(void);
+
+/* Inputs */
+void sim_motion(int detected);
+
+/* Touch pad: one conversion of the floating pad reads level + touch
+ * (plus the drift terms), in single-ended counts */
+typedef struct
+{
+    double level;     /* Untouched reading at 25 C and 3.3 V */
+    double touch;     /* Added by a finger on the pad */
+    double white;     /* Per-conversion noise, counts rms */
+    double hum;       /* Common-mode interference, counts peak */
+    double hum_hz;
+    double kt;        /* Counts per kelvin from 25 C */
+    double kv;        /* Counts per volt from 3.3 V */
+} sim_pad_t;
+
+extern sim_pad_t sim_pad;
+extern double sim_vdd;        /* Volts */
+extern double sim_temp_c;     /* Die temperature, Celsius */
+
+/* 74HC595 chain: the storage register, and its change log */
+uint64_t sim_outputs(void);
+uint64_t sim_changed_at(void);
+uint64_t sim_wait_outputs(uint64_t value, uint64_t deadline);
+uint32_t sim_latches(void);
+void sim_duty_reset(void);
+double sim_duty(unsigned strip);
+
+/* Counters over the whole run */
+typedef struct
+{
+    uint64_t awake;            /* Cycles running code */
+    uint64_t awake_max;        /* Longest stretch between two sleeps */
+    uint64_t asleep[3];        /* Cycles in idle, standby, power-down */
+    uint32_t sleeps[3];
+    uint32_t isr[32];          /* Dispatches per vector number */
+    uint64_t isr_accesses[32]; /* Register accesses in each ISR plus
+                                  SIM_ISR_CYCLES, nested ones included:
+                                  a proxy for its I/O work, not cycles */
+    uint32_t isr_max[32];      /* Longest single run, same units */
+    uint32_t conversions;      /* ADC0 accumulated results */
+    uint32_t eeprom_writes;
+    uint32_t spi_aborts;       /* Transfers cut off by disabling SPI0 */
+    uint32_t bad_precharge;    /* Pad conversions with no known charge */
+} sim_stats_t;
+
+extern sim_stats_t sim_stats;
+
+/* Results */
+void sim_report(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void sim_fail(const char *fmt, ...) __attribute__((format(printf, 1, 2), noreturn));
+
+#define SIM_EXPECT(cond, ...)  do { if (!(cond)) sim_fail(__VA_ARGS__); } while (0)
+
+/* Deterministic noise for the models and the scenarios */
+double sim_uniform(void);
+double sim_gauss(void);
+
+#endif /* SIM_H */
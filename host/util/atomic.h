@@ -0,0 +1,37 @@
+/*
+ * atomic.h (host simulation build): avr-libc's ATOMIC_BLOCK on the
+ * simulated SREG. The block's cleanup runs on every way out of it.
+ */
+
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#include <avr/interrupt.h>
+
+static inline uint8_t sim_atomic_enter(void)
+{
+    cli();
+    return 1;
+}
+
+static inline void sim_atomic_restore(const uint8_t *sreg)
+{
+    SREG = *sreg;
+}
+
+static inline void sim_atomic_forceon(const uint8_t *sreg)
+{
+    (void)sreg;
+    sei();
+}
+
+#define ATOMIC_BLOCK(type) \
+    for (type, sim_atomic_todo = sim_atomic_enter(); sim_atomic_todo; sim_atomic_todo = 0)
+
+#define ATOMIC_RESTORESTATE \
+    uint8_t sim_atomic_sreg __attribute__((__cleanup__(sim_atomic_restore))) = SREG
+
+#define ATOMIC_FORCEON \
+    uint8_t sim_atomic_sreg __attribute__((__cleanup__(sim_atomic_forceon))) = 0
+
+#endif /* SIM_UTIL_ATOMIC_H */
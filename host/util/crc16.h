@@ -0,0 +1,24 @@
+/*
+ * crc16.h (host simulation build): the avr-libc C reference for the
+ * CRC-8 used by the firmware.
+ */
+
+#ifndef SIM_UTIL_CRC16_H
+#define SIM_UTIL_CRC16_H
+
+#include <stdint.h>
+
+/* Polynomial x^8 + x^2 + x + 1 (0x07), MSB first */
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+    crc ^= data;
+
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+
+    return crc;
+}
+
+#endif /* SIM_UTIL_CRC16_H */
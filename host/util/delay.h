@@ -0,0 +1,13 @@
+/*
+ * delay.h (host simulation build): busy-waits advance virtual time.
+ */
+
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+void sim_delay_cycles(unsigned long cycles);
+
+#define _delay_us(us)  sim_delay_cycles((unsigned long)((us) * (F_CPU / 1e6)))
+#define _delay_ms(ms)  sim_delay_cycles((unsigned long)((ms) * (F_CPU / 1e3)))
+
+#endif /* SIM_UTIL_DELAY_H */